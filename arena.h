@@ -0,0 +1,49 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <new>
+#include <vector>
+
+//Chunked bump allocator for objects that live until the tool exits.
+//Objects are default-constructed in place and never destroyed or freed
+//individually, so allocation is a pointer bump except when a new chunk
+//is needed. Returned pointers stay valid as the arena grows.
+template<class T>
+class Arena
+{
+public:
+   Arena(size_t chunk_size = 4096)
+      : chunk_size(chunk_size), next(NULL), end(NULL) {}
+
+   ~Arena()
+   {
+      for(size_t i=0;i<chunks.size();++i) ::operator delete(chunks[i]);
+   }
+
+   //allocate n contiguous objects
+   T* alloc(size_t n = 1)
+   {
+      if(next == NULL || (size_t)(end-next) < n) {
+         size_t size = n > chunk_size ? n : chunk_size;
+         next = static_cast<T*>(::operator new(size*sizeof(T)));
+         end = next+size;
+         chunks.push_back(next);
+      }
+      T* p = next;
+      next += n;
+      for(size_t i=0;i<n;++i) new (p+i) T();
+      return p;
+   }
+
+private:
+   Arena(const Arena&);
+   Arena& operator=(const Arena&);
+
+   size_t chunk_size;
+   T* next;
+   T* end;
+   std::vector<T*> chunks;
+};
+
+#endif
@@ -0,0 +1,135 @@
+//Microbenchmark for the per-branch stream lookup done in streamcount's branch_taken().
+//Compares the original std::map lookup against the StreamHash table, with and
+//without the per call site cache, on a synthetic loop-heavy branch sequence.
+//
+//usage: bench_streamhash [unique streams] [branches] [average loop trip count]
+
+#include <iostream>
+#include <map>
+#include <vector>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "stream_hash.h"
+
+using namespace std;
+
+typedef pair<uint64_t,uint32_t> key;
+typedef map<key,uint32_t> stream_map;
+
+typedef struct {
+   uint64_t sa;
+   uint32_t sl;
+   uint32_t site; //call site that ends this stream
+} stream_key;
+
+typedef struct {
+   uint64_t sa;
+   uint32_t sl;
+   uint32_t id;
+} branch_site;
+
+static double now()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC,&ts);
+   return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+int main(int argc, char** argv)
+{
+   uint32_t unique = argc>1 ? atoi(argv[1]) : 300000;
+   uint32_t branches = argc>2 ? atoi(argv[2]) : 20000000;
+   uint32_t trips = argc>3 ? atoi(argv[3]) : 8;
+
+   //streams start at block addresses spread over a large text segment
+   srand(1);
+   vector<stream_key> streams(unique);
+   for(uint32_t i=0;i<unique;++i) {
+      streams[i].sa = 0x400000 + (uint64_t)i*48 + (rand()%4)*4;
+      streams[i].sl = 1 + rand()%24;
+      streams[i].site = rand()%(unique/2+1); //some sites, e.g. returns, end several streams
+   }
+
+   //a branch sequence of loops: a stream repeats a few times, then control moves on
+   vector<uint32_t> sequence;
+   sequence.reserve(branches);
+   while(sequence.size() < branches) {
+      uint32_t s = rand()%unique;
+      uint32_t n = 1 + rand()%(2*trips);
+      for(uint32_t i=0;i<n && sequence.size()<branches;++i) sequence.push_back(s);
+   }
+
+   double t0, elapsed;
+   uint64_t checksum;
+
+   //original: std::map find, insert, find again
+   {
+      stream_map ids;
+      uint32_t next_id = 0;
+      checksum = 0;
+      t0 = now();
+      for(uint32_t i=0;i<branches;++i) {
+         const stream_key& s = streams[sequence[i]];
+         key k(s.sa,s.sl);
+         stream_map::iterator loc = ids.find(k);
+         if(loc == ids.end()) {
+            ids.insert(pair<key,uint32_t>(k,next_id++));
+            loc = ids.find(k);
+         }
+         checksum += loc->second;
+      }
+      elapsed = now()-t0;
+      cout << "std::map:            " << elapsed*1e9/branches << " ns/branch (checksum " << checksum << ")" << endl;
+   }
+
+   //open-addressing hash
+   {
+      StreamHash ids;
+      uint32_t next_id = 0;
+      checksum = 0;
+      t0 = now();
+      for(uint32_t i=0;i<branches;++i) {
+         const stream_key& s = streams[sequence[i]];
+         uint32_t id = ids.find(s.sa,s.sl);
+         if(id == StreamHash::NOT_FOUND) id = ids.insert(s.sa,s.sl,next_id++);
+         checksum += id;
+      }
+      elapsed = now()-t0;
+      cout << "StreamHash:          " << elapsed*1e9/branches << " ns/branch (checksum " << checksum << ")" << endl;
+   }
+
+   //open-addressing hash behind the per call site cache
+   {
+      StreamHash ids;
+      vector<branch_site> sites(unique/2+1);
+      for(uint32_t i=0;i<sites.size();++i) sites[i].id = StreamHash::NOT_FOUND;
+      uint32_t next_id = 0;
+      uint32_t hits = 0;
+      checksum = 0;
+      t0 = now();
+      for(uint32_t i=0;i<branches;++i) {
+         const stream_key& s = streams[sequence[i]];
+         branch_site* site = &sites[s.site];
+         uint32_t id;
+         if(site->id != StreamHash::NOT_FOUND && site->sa == s.sa && site->sl == s.sl) {
+            id = site->id;
+            hits++;
+         }
+         else {
+            id = ids.find(s.sa,s.sl);
+            if(id == StreamHash::NOT_FOUND) id = ids.insert(s.sa,s.sl,next_id++);
+            site->sa = s.sa;
+            site->sl = s.sl;
+            site->id = id;
+         }
+         checksum += id;
+      }
+      elapsed = now()-t0;
+      cout << "StreamHash+site:     " << elapsed*1e9/branches << " ns/branch (checksum " << checksum
+           << ", site cache hit rate " << (double)hits/branches << ")" << endl;
+   }
+
+   return 0;
+}
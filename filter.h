@@ -0,0 +1,327 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <regex.h>
+
+#include "parallel.h"
+
+//Stream filters for pinvis. A query is a list of clauses separated by
+//spaces, all of which must hold:
+//   img=NAME  rtn=NAME     image or routine name is NAME ("quoted" if it has spaces)
+//   img~RE    rtn~RE       name matches the POSIX extended regular expression RE
+//   scount OP N            execution count   (OP is one of = < <= > >=)
+//   sl OP N                stream length in instructions
+//   ls OP N                memory-referencing instructions
+//   mem OP X               share of memory-referencing instructions, 0 to 1
+//and a clause prefixed with ! must not hold. Names are matched by their
+//interned id: bind() evaluates each name clause once per distinct name, so
+//matching a stream is a few table lookups and comparisons.
+
+//a stream as the filters see it
+typedef struct {
+   uint32_t img; //interned name ids
+   uint32_t rtn;
+   uint32_t sl;
+   uint32_t lscount;
+   uint64_t scount;
+} filter_stream;
+
+class StreamFilter
+{
+public:
+   StreamFilter() {}
+   StreamFilter(const StreamFilter& other) { *this = other; }
+   ~StreamFilter() { release(); }
+
+   StreamFilter& operator=(const StreamFilter& other)
+   {
+      if(this == &other) return *this;
+      release();
+      text = other.text;
+      for(size_t i=0;i<other.clauses.size();++i) {
+         std::string error;
+         clauses.push_back(other.clauses[i]);
+         clauses.back().regex = NULL;
+         if(other.clauses[i].regex) compile(&clauses.back(),&error);
+      }
+      return *this;
+   }
+
+   //parse query; false with a message in *error if it is malformed
+   bool parse(const std::string& query, std::string* error)
+   {
+      release();
+      text = query;
+      size_t i = 0;
+      while(i < query.size()) {
+         if(query[i] == ' ' || query[i] == '\t') {
+            i++;
+            continue;
+         }
+         clause c;
+         c.negate = query[i] == '!';
+         if(c.negate) i++;
+         size_t name_end = i;
+         while(name_end < query.size() && isalpha((unsigned char)query[name_end])) name_end++;
+         std::string field = query.substr(i,name_end-i);
+         i = name_end;
+         if(!parse_op(query,&i,&c.op)) {
+            *error = "expected one of = ~ < <= > >= after '"+field+"'";
+            return false;
+         }
+         std::string value = parse_value(query,&i);
+         if(value.empty()) {
+            *error = "missing value for '"+field+"'";
+            return false;
+         }
+         c.regex = NULL;
+         if(field == "img" || field == "rtn") {
+            c.field = field == "img" ? IMG : RTN;
+            if(c.op != EQ && c.op != MATCH) {
+               *error = "names compare with = or ~";
+               return false;
+            }
+            c.pattern = value;
+            if(c.op == MATCH && !compile(&c,error)) return false;
+         }
+         else {
+            if(field == "scount") c.field = SCOUNT;
+            else if(field == "sl") c.field = SL;
+            else if(field == "ls") c.field = LSCOUNT;
+            else if(field == "mem") c.field = MEM;
+            else {
+               *error = "unknown field '"+field+"'";
+               return false;
+            }
+            if(c.op == MATCH) {
+               *error = "'"+field+"' is a number";
+               return false;
+            }
+            char* end;
+            c.number = strtod(value.c_str(),&end);
+            if(*end != 0) {
+               *error = "'"+value+"' is not a number";
+               return false;
+            }
+         }
+         clauses.push_back(c);
+      }
+      return true;
+   }
+
+   //evaluate the name clauses for the names not seen yet; names[id] is the name of id
+   void bind(const std::vector<const char*>& names)
+   {
+      for(size_t k=0;k<clauses.size();++k) {
+         clause& c = clauses[k];
+         if(c.field != IMG && c.field != RTN) continue;
+         for(size_t id=c.names.size();id<names.size();++id) {
+            bool match = c.op == EQ ? c.pattern == names[id] : regexec(c.regex,names[id],0,NULL,0) == 0;
+            c.names.push_back(match);
+         }
+      }
+   }
+
+   //true if s meets every clause; names must have been bound
+   bool match(const filter_stream& s) const
+   {
+      for(size_t k=0;k<clauses.size();++k) {
+         const clause& c = clauses[k];
+         bool holds;
+         switch(c.field) {
+            case IMG: holds = s.img < c.names.size() && c.names[s.img]; break;
+            case RTN: holds = s.rtn < c.names.size() && c.names[s.rtn]; break;
+            case SCOUNT: holds = compare(c,(double)s.scount); break;
+            case SL: holds = compare(c,s.sl); break;
+            case LSCOUNT: holds = compare(c,s.lscount); break;
+            default: holds = compare(c,s.sl ? (double)s.lscount/s.sl : 0.0); break;
+         }
+         if(holds == c.negate) return false;
+      }
+      return true;
+   }
+
+   const std::string& query() const { return text; }
+
+private:
+   enum Field { IMG, RTN, SCOUNT, SL, LSCOUNT, MEM };
+   enum Op { EQ, MATCH, LT, LE, GT, GE };
+
+   typedef struct {
+      Field field;
+      Op op;
+      bool negate;
+      double number;
+      std::string pattern;
+      regex_t* regex; //compiled pattern of a ~ clause
+      std::vector<bool> names; //by name id: does the name clause hold
+   } clause;
+
+   static bool parse_op(const std::string& q, size_t* i, Op* op)
+   {
+      if(*i >= q.size()) return false;
+      char c = q[*i];
+      bool eq = *i+1 < q.size() && q[*i+1] == '=';
+      switch(c) {
+         case '=': *op = EQ; break;
+         case '~': *op = MATCH; break;
+         case '<': *op = eq ? LE : LT; break;
+         case '>': *op = eq ? GE : GT; break;
+         default: return false;
+      }
+      *i += (c == '<' || c == '>') && eq ? 2 : 1;
+      return true;
+   }
+
+   //up to the next space, or a "quoted" string
+   static std::string parse_value(const std::string& q, size_t* i)
+   {
+      std::string value;
+      if(*i < q.size() && q[*i] == '"') {
+         size_t end = q.find('"',*i+1);
+         if(end == std::string::npos) end = q.size();
+         value = q.substr(*i+1,end-*i-1);
+         *i = end+1;
+         return value;
+      }
+      while(*i < q.size() && q[*i] != ' ' && q[*i] != '\t') value += q[(*i)++];
+      return value;
+   }
+
+   static bool compare(const clause& c, double v)
+   {
+      switch(c.op) {
+         case LT: return v < c.number;
+         case LE: return v <= c.number;
+         case GT: return v > c.number;
+         case GE: return v >= c.number;
+         default: return v == c.number;
+      }
+   }
+
+   static bool compile(clause* c, std::string* error)
+   {
+      c->regex = new regex_t;
+      int status = regcomp(c->regex,c->pattern.c_str(),REG_EXTENDED|REG_NOSUB);
+      if(status == 0) return true;
+      char message[256];
+      regerror(status,c->regex,message,sizeof(message));
+      *error = "bad regular expression '"+c->pattern+"': "+message;
+      delete c->regex;
+      c->regex = NULL;
+      return false;
+   }
+
+   void release()
+   {
+      for(size_t i=0;i<clauses.size();++i) {
+         if(clauses[i].regex) {
+            regfree(clauses[i].regex);
+            delete clauses[i].regex;
+         }
+      }
+      clauses.clear();
+   }
+
+   std::string text;
+   std::vector<clause> clauses;
+};
+
+//A stack of filters: a stream is visible when it matches every "keep"
+//filter and no "hide" filter. Filters are undone by popping them.
+class FilterSet
+{
+public:
+   void push(const StreamFilter& filter, bool keep)
+   {
+      rules.push_back(rule());
+      rules.back().filter = filter;
+      rules.back().keep = keep;
+   }
+   void pop() { if(!rules.empty()) rules.pop_back(); }
+   void clear() { rules.clear(); }
+   bool empty() const { return rules.empty(); }
+   size_t size() const { return rules.size(); }
+
+   void bind(const std::vector<const char*>& names)
+   {
+      for(size_t i=0;i<rules.size();++i) rules[i].filter.bind(names);
+   }
+
+   bool visible(const filter_stream& s) const
+   {
+      for(size_t i=0;i<rules.size();++i) {
+         if(rules[i].filter.match(s) != rules[i].keep) return false;
+      }
+      return true;
+   }
+
+   //bit i of *bits is set if streams[i] is visible; evaluated on threads cores
+   void evaluate(const std::vector<filter_stream>& streams, std::vector<uint64_t>* bits, unsigned threads) const
+   {
+      bits->assign((streams.size()+63)/64,0);
+      std::vector<task> tasks(threads ? threads : 1);
+      for(size_t i=0;i<tasks.size();++i) {
+         tasks[i].set = this;
+         tasks[i].streams = &streams;
+         tasks[i].bits = bits->empty() ? NULL : &(*bits)[0];
+      }
+      parallel_for(tasks,bits->size());
+   }
+
+   //the queries, for display: +query for keep, -query for hide
+   std::string describe() const
+   {
+      std::ostringstream out;
+      for(size_t i=0;i<rules.size();++i) {
+         out << (i ? " " : "") << (rules[i].keep ? "+" : "-") << "[" << rules[i].filter.query() << "]";
+      }
+      return out.str();
+   }
+
+private:
+   typedef struct {
+      StreamFilter filter;
+      bool keep; //show only matching streams; otherwise hide them
+   } rule;
+
+   //a slice of the bitset's words, so threads never share a word
+   typedef struct task {
+      const FilterSet* set;
+      const std::vector<filter_stream>* streams;
+      uint64_t* bits;
+      void run(uint64_t begin, uint64_t end)
+      {
+         for(uint64_t w=begin;w<end;++w) {
+            uint64_t word = 0;
+            for(uint64_t i=w*64;i<(w+1)*64 && i<streams->size();++i) {
+               if(set->visible((*streams)[i])) word |= (uint64_t)1 << (i-w*64);
+            }
+            bits[w] = word;
+         }
+      }
+   } task;
+
+   std::vector<rule> rules;
+};
+
+//show or hide the n cubes of a stream starting at instance first. *drawn
+//is the stream's own record of whether they are drawn and the only one
+//read: recoloring rewrites the cubes' colors, so they cannot tell. The
+//cubes are only touched when the state changes; true if it did.
+template<class Cubes>
+bool draw_stream(Cubes* cubes, uint32_t first, uint32_t n, bool* drawn, bool draw)
+{
+   if(*drawn == draw) return false;
+   *drawn = draw;
+   for(uint32_t j=0;j<n;++j) cubes->setVisible(first+j,draw);
+   return true;
+}
+
+#endif
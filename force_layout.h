@@ -0,0 +1,267 @@
+#ifndef FORCE_LAYOUT_H
+#define FORCE_LAYOUT_H
+
+#include <stdint.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+#include "parallel.h"
+
+//Force-directed placement of points in the plane (Fruchterman & Reingold):
+//every pair of points repels, points joined by an edge attract in
+//proportion to its weight, and a weak pull toward the origin keeps
+//unconnected points from drifting off. Repulsion is approximated with a
+//quadtree (Barnes & Hut): a far cell acts as one point at its center of
+//mass, so a step costs O(n log n). The forces on the points are computed
+//on all cores, each thread for its own slice of points. The step size
+//cools every step and the layout is converged once it is small.
+
+typedef struct {
+   uint32_t a; //points
+   uint32_t b;
+   float weight; //0 to 1
+} force_edge;
+
+class ForceLayout
+{
+public:
+   ForceLayout() : spacing(2), theta(1.0f), gravity(1), cooling(0.95f), n(0), temperature(0), steps(0) {}
+
+   //start from the positions xy (x,y of each point) with these edges
+   void init(const std::vector<float>& xy, const std::vector<force_edge>& edges)
+   {
+      pos = xy;
+      n = pos.size()/2;
+      disp.assign(pos.size(),0);
+      //the edges of each point, both ways (CSR)
+      adjacent_start.assign(n+1,0);
+      for(size_t k=0;k<edges.size();++k) {
+         adjacent_start[edges[k].a+1]++;
+         adjacent_start[edges[k].b+1]++;
+      }
+      for(uint32_t i=0;i<n;++i) adjacent_start[i+1] += adjacent_start[i];
+      adjacent.resize(adjacent_start[n]);
+      std::vector<uint32_t> fill(adjacent_start.begin(),adjacent_start.end()-1);
+      for(size_t k=0;k<edges.size();++k) {
+         neighbor to_b = { edges[k].b, edges[k].weight };
+         neighbor to_a = { edges[k].a, edges[k].weight };
+         adjacent[fill[edges[k].a]++] = to_b;
+         adjacent[fill[edges[k].b]++] = to_a;
+      }
+      temperature = spacing*sqrtf((float)n)/8;
+      if(temperature < spacing) temperature = spacing;
+      steps = 0;
+   }
+
+   //move every point once, on threads cores; false once converged
+   bool step(unsigned threads)
+   {
+      if(converged()) return false;
+      build_tree();
+      std::vector<task> tasks(threads ? threads : 1);
+      for(size_t i=0;i<tasks.size();++i) tasks[i].layout = this;
+      parallel_for(tasks,n);
+      //each point moves along its force, by at most the temperature
+      for(uint32_t i=0;i<n;++i) {
+         float dx = disp[2*i], dy = disp[2*i+1];
+         float d = sqrtf(dx*dx+dy*dy);
+         if(d == 0) continue;
+         float move = d < temperature ? d : temperature;
+         pos[2*i] += dx/d*move;
+         pos[2*i+1] += dy/d*move;
+      }
+      temperature *= cooling;
+      steps++;
+      return !converged();
+   }
+
+   bool converged() const { return n == 0 || temperature < spacing*0.01f; }
+   uint32_t iterations() const { return steps; }
+   const std::vector<float>& positions() const { return pos; }
+
+   //repulsion on point i from every other point, exactly and with the tree
+   //built by the last step(); for checking the approximation
+   void repulsion(uint32_t i, float* exact, float* approximate) const
+   {
+      exact[0] = exact[1] = 0;
+      for(uint32_t j=0;j<n;++j) {
+         if(j != i) repel(i,pos[2*j],pos[2*j+1],1,exact);
+      }
+      approximate[0] = approximate[1] = 0;
+      tree_repulsion(i,approximate);
+   }
+
+   float spacing; //distance a single edge of weight 1 settles at
+   float theta; //cells smaller than theta times their distance count as one point
+   float gravity; //pull toward the origin, per unit of distance
+   float cooling; //the step size shrinks by this factor every step
+
+private:
+   enum { NO_CELL = 0xffffffffu, LEAF_POINTS = 8, MAX_DEPTH = 48 };
+
+   typedef struct {
+      uint32_t point;
+      float weight;
+   } neighbor;
+
+   //a square of the quadtree; children are 4 consecutive cells
+   typedef struct {
+      float x, y; //center of mass
+      float mass; //points in it
+      float x0, y0; //corner
+      float size; //side
+      uint32_t first_child; //NO_CELL for a leaf
+      uint32_t begin; //its points are order[begin,end)
+      uint32_t end;
+   } cell;
+
+   //the forces on a slice of the points
+   typedef struct task {
+      ForceLayout* layout;
+      void run(uint64_t begin, uint64_t end)
+      {
+         for(uint64_t i=begin;i<end;++i) layout->force(i);
+      }
+   } task;
+
+   //force on point i into disp; reads only positions and the tree
+   void force(uint32_t i)
+   {
+      float f[2] = { 0, 0 };
+      tree_repulsion(i,f);
+      float x = pos[2*i], y = pos[2*i+1];
+      for(uint32_t k=adjacent_start[i];k<adjacent_start[i+1];++k) {
+         const neighbor& m = adjacent[k];
+         float dx = pos[2*m.point]-x, dy = pos[2*m.point+1]-y;
+         float d = sqrtf(dx*dx+dy*dy);
+         //d^2/spacing toward the neighbor, times the weight
+         f[0] += m.weight*dx*d/spacing;
+         f[1] += m.weight*dy*d/spacing;
+      }
+      f[0] -= gravity*x;
+      f[1] -= gravity*y;
+      disp[2*i] = f[0];
+      disp[2*i+1] = f[1];
+   }
+
+   //spacing^2*mass/d away from (x,y); coincident points are pushed apart along x
+   void repel(uint32_t i, float x, float y, float mass, float* f) const
+   {
+      float dx = pos[2*i]-x, dy = pos[2*i+1]-y;
+      float d2 = dx*dx+dy*dy;
+      if(d2 < 1e-6f) {
+         dx = (i&1) ? 0.001f : -0.001f;
+         dy = 0;
+         d2 = 1e-6f;
+      }
+      float s = spacing*spacing*mass/d2;
+      f[0] += dx*s;
+      f[1] += dy*s;
+   }
+
+   void tree_repulsion(uint32_t i, float* f) const
+   {
+      if(cells.empty()) return;
+      float x = pos[2*i], y = pos[2*i+1];
+      //each level down pushes 3 more cells than it pops
+      uint32_t stack[3*MAX_DEPTH+4];
+      int top = 0;
+      stack[top++] = 0;
+      while(top > 0) {
+         const cell& c = cells[stack[--top]];
+         if(c.mass == 0) continue;
+         if(c.first_child == NO_CELL) {
+            for(uint32_t k=c.begin;k<c.end;++k) {
+               uint32_t j = order[k];
+               if(j != i) repel(i,pos[2*j],pos[2*j+1],1,f);
+            }
+            continue;
+         }
+         float dx = x-c.x, dy = y-c.y;
+         bool inside = x >= c.x0 && x < c.x0+c.size && y >= c.y0 && y < c.y0+c.size;
+         if(!inside && c.size*c.size < theta*theta*(dx*dx+dy*dy)) {
+            repel(i,c.x,c.y,c.mass,f);
+            continue;
+         }
+         for(uint32_t k=0;k<4;++k) stack[top++] = c.first_child+k;
+      }
+   }
+
+   void build_tree()
+   {
+      cells.clear();
+      order.resize(n);
+      for(uint32_t i=0;i<n;++i) order[i] = i;
+      if(n == 0) return;
+      float lo[2] = { pos[0], pos[1] }, hi[2] = { pos[0], pos[1] };
+      for(uint32_t i=0;i<n;++i) {
+         for(int a=0;a<2;++a) {
+            lo[a] = std::min(lo[a],pos[2*i+a]);
+            hi[a] = std::max(hi[a],pos[2*i+a]);
+         }
+      }
+      float size = std::max(hi[0]-lo[0],hi[1]-lo[1])+1e-3f;
+      cells.push_back(cell());
+      split(0,0,n,lo[0],lo[1],size,0);
+   }
+
+   //fill cell c, the square at (x0,y0) with points order[begin,end), and its children
+   void split(uint32_t c, uint32_t begin, uint32_t end, float x0, float y0, float size, int depth)
+   {
+      float mx = 0, my = 0;
+      for(uint32_t k=begin;k<end;++k) {
+         mx += pos[2*order[k]];
+         my += pos[2*order[k]+1];
+      }
+      cell& it = cells[c];
+      it.mass = end-begin;
+      it.x = begin < end ? mx/(end-begin) : 0;
+      it.y = begin < end ? my/(end-begin) : 0;
+      it.x0 = x0;
+      it.y0 = y0;
+      it.size = size;
+      it.begin = begin;
+      it.end = end;
+      it.first_child = NO_CELL;
+      //points closer than this stay together in a leaf
+      if(end-begin <= LEAF_POINTS || size < spacing*1e-3f || depth == MAX_DEPTH) return;
+
+      float half = size/2;
+      uint32_t* first = &order[0]+begin;
+      uint32_t* last = &order[0]+end;
+      uint32_t* mid = std::partition(first,last,left_of(this,x0+half,0));
+      uint32_t* bottom_left = std::partition(first,mid,left_of(this,y0+half,1));
+      uint32_t* bottom_right = std::partition(mid,last,left_of(this,y0+half,1));
+      uint32_t child = cells.size();
+      cells[c].first_child = child;
+      cells.resize(child+4);
+      uint32_t bounds[5] = { begin, (uint32_t)(bottom_left-&order[0]), (uint32_t)(mid-&order[0]),
+                             (uint32_t)(bottom_right-&order[0]), end };
+      split(child,bounds[0],bounds[1],x0,y0,half,depth+1);
+      split(child+1,bounds[1],bounds[2],x0,y0+half,half,depth+1);
+      split(child+2,bounds[2],bounds[3],x0+half,y0,half,depth+1);
+      split(child+3,bounds[3],bounds[4],x0+half,y0+half,half,depth+1);
+   }
+
+   //points below a split along axis
+   typedef struct left_of {
+      const ForceLayout* layout;
+      float split;
+      int axis;
+      left_of(const ForceLayout* layout, float split, int axis) : layout(layout), split(split), axis(axis) {}
+      bool operator()(uint32_t i) const { return layout->pos[2*i+axis] < split; }
+   } left_of;
+
+   uint32_t n;
+   std::vector<float> pos; //x,y of each point
+   std::vector<float> disp; //force on each point in the current step
+   std::vector<uint32_t> adjacent_start; //edges of point i are adjacent[adjacent_start[i]..adjacent_start[i+1])
+   std::vector<neighbor> adjacent;
+   std::vector<cell> cells; //the quadtree, root first
+   std::vector<uint32_t> order; //points, grouped by cell
+   float temperature; //largest move this step
+   uint32_t steps;
+};
+
+#endif
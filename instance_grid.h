@@ -0,0 +1,163 @@
+#ifndef INSTANCE_GRID_H
+#define INSTANCE_GRID_H
+
+#include <stdint.h>
+#include <math.h>
+#include <vector>
+
+//Spatial index for picking among unit boxes [c,c+1] given by their min
+//corners. Each box is listed under every grid cell it overlaps, and the
+//cells are hashed into buckets stored as one array (CSR), so building is
+//two linear passes and a pick walks only the cells along the ray, nearest
+//first, stopping at the first cell that contains a hit.
+class InstanceGrid
+{
+public:
+   enum { NO_BOX = 0xffffffffu };
+
+   explicit InstanceGrid(float cell_size = 4.0f) : cell(cell_size), mask(0) {}
+
+   //index count boxes whose corners are stride floats apart
+   void build(const float* corners, uint32_t stride, uint32_t count)
+   {
+      uint32_t nbuckets = 1;
+      while(nbuckets < count/2) nbuckets *= 2;
+      mask = nbuckets-1;
+      start.assign(nbuckets+1,0);
+      items.clear();
+      for(int a=0;a<3;++a) {
+         lo[a] = count ? corners[a] : 0;
+         hi[a] = count ? corners[a]+1 : 0;
+      }
+      for(uint32_t i=0;i<count;++i) {
+         const float* c = corners+(uint64_t)stride*i;
+         for(int a=0;a<3;++a) {
+            if(c[a] < lo[a]) lo[a] = c[a];
+            if(c[a]+1 > hi[a]) hi[a] = c[a]+1;
+         }
+      }
+      //count, then place, the boxes of each bucket
+      for(int pass=0;pass<2;++pass) {
+         for(uint32_t i=0;i<count;++i) {
+            const float* c = corners+(uint64_t)stride*i;
+            int first[3], last[3];
+            for(int a=0;a<3;++a) {
+               first[a] = cell_of(c[a]);
+               last[a] = cell_of(nextafterf(c[a]+1,c[a])); //boxes only touching the next cell stay out of it
+            }
+            for(int x=first[0];x<=last[0];++x)
+               for(int y=first[1];y<=last[1];++y)
+                  for(int z=first[2];z<=last[2];++z) {
+                     uint32_t b = bucket(x,y,z);
+                     if(pass == 0) start[b+1]++;
+                     else items[fill[b]++] = i;
+                  }
+         }
+         if(pass == 0) {
+            for(uint32_t b=0;b<nbuckets;++b) start[b+1] += start[b];
+            items.resize(start[nbuckets]);
+            fill.assign(start.begin(),start.end()-1);
+         }
+      }
+      std::vector<uint32_t>().swap(fill);
+   }
+
+   //nearest box hit by origin+dir*t, 0<=t<=1, among those visible(i) accepts
+   template<class Visible>
+   uint32_t pick(const float* corners, uint32_t stride, const float* origin, const float* dir,
+                 const Visible& visible, float* hit_t = NULL) const
+   {
+      float t0, t1;
+      if(items.empty() || !segment_box(origin,dir,lo,hi,&t0,&t1)) return NO_BOX;
+
+      //walk the cells along the ray (Amanatides & Woo)
+      int c[3], step[3];
+      float next[3], delta[3];
+      for(int a=0;a<3;++a) {
+         float p = origin[a]+dir[a]*t0;
+         c[a] = cell_of(p);
+         if(dir[a] > 0) {
+            step[a] = 1;
+            next[a] = t0+((c[a]+1)*cell-p)/dir[a];
+            delta[a] = cell/dir[a];
+         }
+         else if(dir[a] < 0) {
+            step[a] = -1;
+            next[a] = t0+(c[a]*cell-p)/dir[a];
+            delta[a] = -cell/dir[a];
+         }
+         else {
+            step[a] = 0;
+            next[a] = HUGE_VALF;
+            delta[a] = HUGE_VALF;
+         }
+      }
+      uint32_t best = NO_BOX;
+      float best_t = HUGE_VALF;
+      for(;;) {
+         uint32_t b = bucket(c[0],c[1],c[2]);
+         for(uint32_t k=start[b];k<start[b+1];++k) {
+            uint32_t i = items[k];
+            float t, t_out;
+            const float* box = corners+(uint64_t)stride*i;
+            float box_hi[3] = { box[0]+1, box[1]+1, box[2]+1 };
+            if(segment_box(origin,dir,box,box_hi,&t,&t_out) && t < best_t && visible(i)) {
+               best_t = t;
+               best = i;
+            }
+         }
+         int a = next[0] < next[1] ? (next[0] < next[2] ? 0 : 2) : (next[1] < next[2] ? 1 : 2);
+         //every box the ray enters before leaving this cell has been seen
+         if(best_t <= next[a] || next[a] > t1) break;
+         c[a] += step[a];
+         next[a] += delta[a];
+      }
+      if(hit_t && best != NO_BOX) *hit_t = best_t;
+      return best;
+   }
+
+   //slab test: where origin+dir*t, 0<=t<=1, enters and leaves [lo,hi]
+   static bool segment_box(const float* origin, const float* dir, const float* lo, const float* hi, float* t_in, float* t_out)
+   {
+      float t0 = 0, t1 = 1;
+      for(int a=0;a<3;++a) {
+         if(dir[a] == 0) {
+            if(origin[a] < lo[a] || origin[a] > hi[a]) return false;
+            continue;
+         }
+         float near_t = (lo[a]-origin[a])/dir[a];
+         float far_t = (hi[a]-origin[a])/dir[a];
+         if(near_t > far_t) {
+            float swap = near_t;
+            near_t = far_t;
+            far_t = swap;
+         }
+         if(near_t > t0) t0 = near_t;
+         if(far_t < t1) t1 = far_t;
+         if(t0 > t1) return false;
+      }
+      *t_in = t0;
+      *t_out = t1;
+      return true;
+   }
+
+   uint64_t memory_bytes() const { return sizeof(uint32_t)*((uint64_t)start.size()+items.size()); }
+
+private:
+   int cell_of(float x) const { return (int)floorf(x/cell); }
+
+   uint32_t bucket(int x, int y, int z) const
+   {
+      return ((uint32_t)x*73856093u ^ (uint32_t)y*19349663u ^ (uint32_t)z*83492791u) & mask;
+   }
+
+   float cell;
+   uint32_t mask; //buckets-1; a power of two
+   float lo[3]; //bounds of all boxes
+   float hi[3];
+   std::vector<uint32_t> start; //boxes of bucket b are items[start[b]..start[b+1])
+   std::vector<uint32_t> items;
+   std::vector<uint32_t> fill; //scratch while building
+};
+
+#endif
@@ -0,0 +1,632 @@
+#ifndef INSTANCED_CUBES_H
+#define INSTANCED_CUBES_H
+
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/Image>
+#include <osg/Texture2D>
+#include <osg/Program>
+#include <osg/Shader>
+#include <osg/Uniform>
+#include <osg/BoundingBox>
+#include <osg/BlendFunc>
+#include <osg/LineWidth>
+
+#include <vector>
+#include <sstream>
+#include <algorithm>
+#include <stdint.h>
+#include <string.h>
+
+#include "instance_grid.h"
+
+//Every instruction cube of pinvis in one instanced draw. Per-instance data
+//lives in textures indexed by gl_InstanceID: where each instance moves
+//from and to (RGBA32F: xyz, plus the start time and the duration of the
+//move in w) and its color (RGBA8, alpha 0 hides the instance). Instances
+//are drawn in blocks of BLOCK_INSTANCES, one drawable each with its own
+//bounds, so blocks out of view are culled. Hidden instances are not drawn
+//at all: a block's draw covers only its visible ones, listed in a third
+//texture that maps gl_InstanceID to the instance, and only blocks whose
+//visibility changed rebuild their list. There are no scene nodes per
+//instruction and the scene graph stays a single Geode.
+//The vertex shader interpolates moves from one time uniform, so nothing
+//runs per instance per frame; a layout switch writes the textures once.
+//Only the texture rows changed since the last frame are uploaded, so
+//recoloring a stream costs the same however many instances there are.
+class InstancedCubes
+{
+public:
+   static const uint32_t NO_INSTANCE = 0xffffffffu;
+
+   InstancedCubes() : count(0), capacity(0), moving_until(0), grid_valid(false)
+   {
+      //unit cube as one 14-vertex triangle strip
+      static const float strip[14][3] = {
+         {0,1,1}, {1,1,1}, {0,0,1}, {1,0,1}, {1,0,0}, {1,1,1}, {1,1,0},
+         {0,1,1}, {0,1,0}, {0,0,1}, {0,0,0}, {1,0,0}, {0,1,0}, {1,1,0}
+      };
+      vertices = new osg::Vec3Array(14);
+      for(int i=0;i<14;++i) (*vertices)[i] = osg::Vec3(strip[i][0],strip[i][1],strip[i][2]);
+
+      from.init(GL_FLOAT,GL_RGBA32F_ARB,sizeof(float)*4);
+      to.init(GL_FLOAT,GL_RGBA32F_ARB,sizeof(float)*4);
+      colors.init(GL_UNSIGNED_BYTE,GL_RGBA,4);
+      order.init(GL_UNSIGNED_BYTE,GL_RGBA,4);
+      grow(TEXTURE_WIDTH);
+
+      geode = new osg::Geode();
+      osg::StateSet* ss = geode->getOrCreateStateSet();
+      osg::Program* program = new osg::Program();
+      program->addShader(new osg::Shader(osg::Shader::VERTEX,vertexShader()));
+      program->addShader(new osg::Shader(osg::Shader::FRAGMENT,fragmentShader()));
+      ss->setAttributeAndModes(program);
+      ss->setTextureAttributeAndModes(0,from.texture.get());
+      ss->setTextureAttributeAndModes(1,to.texture.get());
+      ss->setTextureAttributeAndModes(2,colors.texture.get());
+      ss->setTextureAttributeAndModes(3,order.texture.get());
+      ss->addUniform(new osg::Uniform("from",0));
+      ss->addUniform(new osg::Uniform("to",1));
+      ss->addUniform(new osg::Uniform("colors",2));
+      ss->addUniform(new osg::Uniform("order",3));
+      time = new osg::Uniform("time",0.0f);
+      time->setDataVariance(osg::Object::DYNAMIC);
+      ss->addUniform(time.get());
+   }
+
+   osg::Geode* node() const { return geode.get(); }
+
+   uint32_t size() const { return count; }
+
+   //append n instances at the origin, white and visible; returns the first
+   uint32_t add(uint32_t n)
+   {
+      uint32_t first = count;
+      if(count+n > capacity) grow(count+n);
+      count += n;
+      while((uint64_t)blocks.size()*BLOCK_INSTANCES < count) addBlock();
+      for(uint32_t i=first;i<count;++i) {
+         writeMove(i,osg::Vec3(0,0,0),osg::Vec3(0,0,0),0,0);
+         setColor(i,1,1,1);
+         colors.texel<unsigned char>(i)[3] = 255;
+         block& b = blocks[i/BLOCK_INSTANCES];
+         if(b.order_valid) writeOrder(i-i%BLOCK_INSTANCES+b.nvisible++,i);
+      }
+      for(uint32_t k=first/BLOCK_INSTANCES;n && k<=(count-1)/BLOCK_INSTANCES;++k) {
+         block& b = blocks[k];
+         b.bounds.expandBy(osg::Vec3(0,0,0));
+         b.bounds.expandBy(osg::Vec3(1,1,1));
+         b.geometry->dirtyBound();
+         if(b.order_valid) setDrawn(&b);
+      }
+      grid_valid = false;
+      return first;
+   }
+
+   //move instance i to target over seconds, starting from where it is now
+   void moveTo(uint32_t i, const osg::Vec3& target, double now, double seconds)
+   {
+      writeMove(i,position(i,now),target,now,seconds);
+      if(now+seconds > moving_until) moving_until = now+seconds;
+      grid_valid = false;
+      //the bounds cover both ends while moving and are tightened once it settles
+      block& b = blocks[i/BLOCK_INSTANCES];
+      if(now+seconds > b.settles) b.settles = now+seconds;
+      b.loose = true;
+      if(!b.bounds.contains(target) || !b.bounds.contains(target+osg::Vec3(1,1,1))) {
+         b.bounds.expandBy(target);
+         b.bounds.expandBy(target+osg::Vec3(1,1,1));
+         b.geometry->dirtyBound();
+      }
+   }
+
+   //where instance i is at time now; the vertex shader computes the same
+   osg::Vec3 position(uint32_t i, double now) const
+   {
+      const float* f = from.texel<float>(i);
+      const float* t = to.texel<float>(i);
+      float s = t[3] > 0 ? (now-f[3])/t[3] : 1;
+      if(s < 0) s = 0;
+      if(s > 1) s = 1;
+      return osg::Vec3(f[0]+(t[0]-f[0])*s,f[1]+(t[1]-f[1])*s,f[2]+(t[2]-f[2])*s);
+   }
+
+   //alpha is left alone: it is the instance's visibility (setVisible)
+   void setColor(uint32_t i, float r, float g, float b)
+   {
+      unsigned char* c = colors.texel<unsigned char>(i);
+      c[0] = (unsigned char)(r*255+0.5f);
+      c[1] = (unsigned char)(g*255+0.5f);
+      c[2] = (unsigned char)(b*255+0.5f);
+      colors.touch(i);
+   }
+
+   void setVisible(uint32_t i, bool visible)
+   {
+      unsigned char* alpha = colors.texel<unsigned char>(i)+3;
+      if((*alpha != 0) == visible) return;
+      *alpha = visible ? 255 : 0;
+      colors.touch(i);
+      blocks[i/BLOCK_INSTANCES].order_valid = false;
+   }
+
+   bool visible(uint32_t i) const { return colors.texel<unsigned char>(i)[3] != 0; }
+
+   //instances drawn if every block is in view: the visible ones
+   uint32_t drawn() const
+   {
+      uint32_t n = 0;
+      for(size_t k=0;k<blocks.size();++k) n += blocks[k].nvisible;
+      return n;
+   }
+
+   //the time moves are interpolated at; the draw lists of blocks whose
+   //visibility changed and the bounds of blocks that stopped moving.
+   //Once per frame, before drawing
+   void update(double now)
+   {
+      time->set((float)now);
+      for(size_t k=0;k<blocks.size();++k) {
+         block& b = blocks[k];
+         uint32_t first = k*BLOCK_INSTANCES;
+         uint32_t end = std::min<uint32_t>(first+BLOCK_INSTANCES,count);
+         if(!b.order_valid) {
+            b.nvisible = 0;
+            for(uint32_t i=first;i<end;++i) {
+               if(visible(i)) writeOrder(first+b.nvisible++,i);
+            }
+            b.order_valid = true;
+            setDrawn(&b);
+         }
+         if(b.loose && now >= b.settles) {
+            b.bounds.init();
+            for(uint32_t i=first;i<end;++i) {
+               const float* t = to.texel<float>(i);
+               b.bounds.expandBy(osg::Vec3(t[0],t[1],t[2]));
+               b.bounds.expandBy(osg::Vec3(t[0]+1,t[1]+1,t[2]+1));
+            }
+            b.loose = false;
+            b.geometry->dirtyBound();
+         }
+      }
+   }
+
+   //true while a move started by moveTo() has not finished
+   bool moving(double now) const { return now < moving_until; }
+
+   //the bounds of all instances, including where they are moving to
+   osg::BoundingBox bounds() const
+   {
+      osg::BoundingBox all;
+      for(size_t k=0;k<blocks.size();++k) all.expandBy(blocks[k].bounds);
+      return all;
+   }
+
+   //let another drawable's shader find instances: binds the position
+   //textures and the time uniform that positionGlsl() reads
+   void sharePositions(osg::StateSet* ss) const
+   {
+      ss->setTextureAttributeAndModes(0,from.texture.get());
+      ss->setTextureAttributeAndModes(1,to.texture.get());
+      ss->addUniform(new osg::Uniform("from",0));
+      ss->addUniform(new osg::Uniform("to",1));
+      ss->addUniform(time.get());
+   }
+
+   //GLSL vec3 instancePosition(int i): where instance i is at time, as position() computes it
+   static std::string positionGlsl()
+   {
+      std::ostringstream s;
+      s << "uniform sampler2D from;\n"
+           "uniform sampler2D to;\n"
+           "uniform float time;\n"
+           "vec3 instancePosition(int i) {\n"
+           "   ivec2 texel = ivec2(i % " << TEXTURE_WIDTH << ", i / " << TEXTURE_WIDTH << ");\n"
+           "   vec4 a = texelFetch(from, texel, 0);\n"
+           "   vec4 b = texelFetch(to, texel, 0);\n"
+           "   float s = b.w > 0.0 ? clamp((time - a.w) / b.w, 0.0, 1.0) : 1.0;\n"
+           "   return mix(a.xyz, b.xyz, s);\n"
+           "}\n";
+      return s.str();
+   }
+
+   //nearest visible instance the segment start-end passes through at time now.
+   //At rest this walks a grid over the instances, built on the first pick
+   //after they moved; while they move every instance is tested.
+   uint32_t pick(const osg::Vec3& start_point, const osg::Vec3& end_point, double now)
+   {
+      osg::Vec3 dir = end_point-start_point;
+      Visible visible(this);
+      if(now >= moving_until) {
+         if(!grid_valid) {
+            grid.build(to.texel<float>(0),4,count);
+            grid_valid = true;
+         }
+         return grid.pick(to.texel<float>(0),4,start_point.ptr(),dir.ptr(),visible);
+      }
+      uint32_t best = NO_INSTANCE;
+      float best_t = 2;
+      for(uint32_t i=0;i<count;++i) {
+         if(!visible(i)) continue;
+         osg::Vec3 lo = position(i,now);
+         osg::Vec3 hi = lo+osg::Vec3(1,1,1);
+         float t, t_out;
+         if(InstanceGrid::segment_box(start_point.ptr(),dir.ptr(),lo.ptr(),hi.ptr(),&t,&t_out) && t < best_t) {
+            best_t = t;
+            best = i;
+         }
+      }
+      return best;
+   }
+
+private:
+   enum { TEXTURE_WIDTH = 1024 }; //instances per texture row
+   enum { BLOCK_INSTANCES = 16*TEXTURE_WIDTH }; //instances per drawable
+
+   //a drawable for instances [k*BLOCK_INSTANCES,(k+1)*BLOCK_INSTANCES);
+   //its visible ones are listed from order slot k*BLOCK_INSTANCES on
+   typedef struct {
+      osg::ref_ptr<osg::Geometry> geometry;
+      osg::ref_ptr<osg::DrawArrays> draw;
+      osg::BoundingBox bounds; //of the block's instances, including where they are moving to
+      double settles; //no instance of the block moves after this time
+      bool loose; //bounds still include where instances moved from
+      uint32_t nvisible;
+      bool order_valid; //false once visibility changed, until update() rebuilds the list
+   } block;
+
+   typedef struct Visible {
+      const InstancedCubes* cubes;
+      Visible(const InstancedCubes* cubes) : cubes(cubes) {}
+      bool operator()(uint32_t i) const { return cubes->visible(i); }
+   } Visible;
+
+   //the bounds of a block's instances, for culling and near/far
+   class InstanceBounds : public osg::Drawable::ComputeBoundingBoxCallback
+   {
+   public:
+      InstanceBounds(const InstancedCubes* cubes, uint32_t k) : cubes(cubes), k(k) {}
+      virtual osg::BoundingBox computeBound(const osg::Drawable&) const { return cubes->blocks[k].bounds; }
+   private:
+      const InstancedCubes* cubes;
+      uint32_t k;
+   };
+
+   //uploads the whole image when the texture is created, then only the rows
+   //touched since the last upload, one glTexSubImage2D per run of adjacent
+   //rows: rows far apart, such as two streams recolored by a timeline step,
+   //cost two rows, not the span between them
+   class RowSubload : public osg::Texture2D::SubloadCallback
+   {
+   public:
+      void touch(uint32_t row)
+      {
+         if(row >= marked.size()) marked.resize(row+1,false);
+         if(marked[row]) return;
+         marked[row] = true;
+         touched.push_back(row);
+      }
+
+      virtual void load(const osg::Texture2D& texture, osg::State&) const
+      {
+         const osg::Image* image = texture.getImage();
+         glTexImage2D(GL_TEXTURE_2D,0,image->getInternalTextureFormat(),image->s(),image->t(),0,
+                      image->getPixelFormat(),image->getDataType(),image->data());
+         clear();
+      }
+
+      virtual void subload(const osg::Texture2D& texture, osg::State&) const
+      {
+         if(touched.empty()) return;
+         const osg::Image* image = texture.getImage();
+         std::sort(touched.begin(),touched.end());
+         for(size_t k=0;k<touched.size();) {
+            uint32_t first = touched[k], end = first+1;
+            for(++k;k<touched.size() && touched[k] == end;++k) end++;
+            glTexSubImage2D(GL_TEXTURE_2D,0,0,first,image->s(),end-first,
+                            image->getPixelFormat(),image->getDataType(),image->data(0,first));
+         }
+         clear();
+      }
+
+   private:
+      void clear() const
+      {
+         for(size_t k=0;k<touched.size();++k) marked[touched[k]] = false;
+         touched.clear();
+      }
+
+      mutable std::vector<uint32_t> touched; //rows changed since the last upload, each once
+      mutable std::vector<bool> marked; //by row: in touched
+   };
+
+   //one per-instance texture: a texel per instance, TEXTURE_WIDTH to a row
+   typedef struct InstanceTexture {
+      GLenum type;
+      GLint internal_format;
+      uint32_t texel_bytes;
+      osg::ref_ptr<osg::Image> image;
+      osg::ref_ptr<osg::Texture2D> texture;
+      osg::ref_ptr<RowSubload> rows;
+
+      void init(GLenum type, GLint internal_format, uint32_t texel_bytes)
+      {
+         this->type = type;
+         this->internal_format = internal_format;
+         this->texel_bytes = texel_bytes;
+         rows = new RowSubload();
+         texture = new osg::Texture2D();
+         texture->setSubloadCallback(rows.get());
+         texture->setFilter(osg::Texture::MIN_FILTER,osg::Texture::NEAREST);
+         texture->setFilter(osg::Texture::MAG_FILTER,osg::Texture::NEAREST);
+         texture->setWrap(osg::Texture::WRAP_S,osg::Texture::CLAMP_TO_EDGE);
+         texture->setWrap(osg::Texture::WRAP_T,osg::Texture::CLAMP_TO_EDGE);
+         texture->setResizeNonPowerOfTwoHint(false);
+         texture->setDataVariance(osg::Object::DYNAMIC);
+      }
+
+      //a new image of nrows rows, with the first old_capacity texels kept
+      void resize(uint32_t nrows, uint32_t old_capacity)
+      {
+         osg::ref_ptr<osg::Image> bigger = new osg::Image();
+         bigger->allocateImage(TEXTURE_WIDTH,nrows,1,GL_RGBA,type);
+         bigger->setInternalTextureFormat(internal_format);
+         memset(bigger->data(),0,texel_bytes*TEXTURE_WIDTH*nrows);
+         if(old_capacity) memcpy(bigger->data(),image->data(),texel_bytes*old_capacity);
+         image = bigger;
+         texture->setImage(image.get());
+         texture->setTextureSize(TEXTURE_WIDTH,nrows);
+         //a new size needs a new texture object, which load() fills
+         texture->dirtyTextureObject();
+      }
+
+      template<class T> T* texel(uint32_t i) { return reinterpret_cast<T*>(image->data()+texel_bytes*i); }
+      template<class T> const T* texel(uint32_t i) const { return reinterpret_cast<const T*>(image->data()+texel_bytes*i); }
+      void touch(uint32_t i) { rows->touch(i/TEXTURE_WIDTH); }
+   } InstanceTexture;
+
+   //room for at least n instances: textures of twice the rows, old data copied
+   void grow(uint32_t n)
+   {
+      uint32_t rows = capacity/TEXTURE_WIDTH;
+      if(rows == 0) rows = 1;
+      while(rows*TEXTURE_WIDTH < n) rows *= 2;
+      from.resize(rows,capacity);
+      to.resize(rows,capacity);
+      colors.resize(rows,capacity);
+      order.resize(rows,capacity);
+      capacity = rows*TEXTURE_WIDTH;
+   }
+
+   void writeMove(uint32_t i, const osg::Vec3& source, const osg::Vec3& target, double now, double seconds)
+   {
+      float* f = from.texel<float>(i);
+      float* t = to.texel<float>(i);
+      f[0] = source[0];
+      f[1] = source[1];
+      f[2] = source[2];
+      f[3] = now;
+      t[0] = target[0];
+      t[1] = target[1];
+      t[2] = target[2];
+      t[3] = seconds;
+      from.touch(i);
+      to.touch(i);
+   }
+
+   //draw slot k shows instance i; the index is stored little-endian in RGBA8
+   void writeOrder(uint32_t k, uint32_t i)
+   {
+      unsigned char* o = order.texel<unsigned char>(k);
+      o[0] = i & 0xff;
+      o[1] = (i >> 8) & 0xff;
+      o[2] = (i >> 16) & 0xff;
+      o[3] = i >> 24;
+      order.touch(k);
+   }
+
+   void addBlock()
+   {
+      uint32_t k = blocks.size();
+      block b;
+      b.geometry = new osg::Geometry();
+      b.geometry->setVertexArray(vertices.get());
+      b.geometry->setUseDisplayList(false);
+      b.geometry->setUseVertexBufferObjects(true);
+      b.draw = new osg::DrawArrays(osg::PrimitiveSet::TRIANGLE_STRIP,0,14,0);
+      b.geometry->addPrimitiveSet(b.draw.get());
+      b.geometry->setComputeBoundingBoxCallback(new InstanceBounds(this,k));
+      b.geometry->getOrCreateStateSet()->addUniform(new osg::Uniform("base",(int)(k*BLOCK_INSTANCES)));
+      b.settles = 0;
+      b.loose = false;
+      b.nvisible = 0;
+      b.order_valid = true;
+      setDrawn(&b);
+      blocks.push_back(b);
+      geode->addDrawable(b.geometry.get());
+   }
+
+   //numInstances 0 would mean a plain draw of one cube, so an empty block draws no vertices
+   void setDrawn(block* b)
+   {
+      b->draw->setCount(b->nvisible ? 14 : 0);
+      b->draw->setNumInstances(b->nvisible);
+      b->draw->dirty();
+   }
+
+   static std::string vertexShader()
+   {
+      std::ostringstream s;
+      s << "#version 130\n"
+           "#extension GL_ARB_draw_instanced : enable\n"
+        << positionGlsl()
+        << "uniform sampler2D colors;\n"
+           "uniform sampler2D order;\n"
+           "uniform int base;\n"
+           "out vec4 color;\n"
+           "out vec3 eye;\n"
+           "void main() {\n"
+           "   int k = base + gl_InstanceIDARB;\n"
+           "   ivec2 slot = ivec2(k % " << TEXTURE_WIDTH << ", k / " << TEXTURE_WIDTH << ");\n"
+           "   ivec4 o = ivec4(texelFetch(order, slot, 0) * 255.0 + 0.5);\n"
+           "   int i = o.r + o.g * 256 + o.b * 65536 + o.a * 16777216;\n"
+           "   color = texelFetch(colors, ivec2(i % " << TEXTURE_WIDTH << ", i / " << TEXTURE_WIDTH << "), 0);\n"
+           "   vec4 p = vec4(gl_Vertex.xyz + instancePosition(i), 1.0);\n"
+           "   eye = (gl_ModelViewMatrix * p).xyz;\n"
+           "   gl_Position = gl_ModelViewProjectionMatrix * p;\n"
+           "}\n";
+      return s.str();
+   }
+
+   static std::string fragmentShader()
+   {
+      //flat shading from the face normal, lit from the eye
+      return "#version 130\n"
+             "in vec4 color;\n"
+             "in vec3 eye;\n"
+             "void main() {\n"
+             "   vec3 n = normalize(cross(dFdx(eye), dFdy(eye)));\n"
+             "   float light = 0.35 + 0.65 * abs(dot(n, normalize(-eye)));\n"
+             "   gl_FragColor = vec4(color.rgb * light, 1.0);\n"
+             "}\n";
+   }
+
+   uint32_t count;
+   uint32_t capacity;
+   double moving_until; //no instance moves after this time
+   InstanceGrid grid; //over the instances' targets, for picking at rest
+   bool grid_valid;
+   InstanceTexture from; //position and start time of each instance's move
+   InstanceTexture to; //target and duration of each instance's move
+   InstanceTexture colors;
+   InstanceTexture order; //draw slot -> instance, for the visible instances
+   std::vector<block> blocks;
+   osg::ref_ptr<osg::Vec3Array> vertices; //the cube, shared by the blocks
+   osg::ref_ptr<osg::Uniform> time;
+   osg::ref_ptr<osg::Geode> geode;
+};
+
+//Lines between instances of an InstancedCubes, such as pinvis's
+//transitions between streams. An end names an instance, not a point: the
+//vertex shader looks the instance up in the cubes' textures, so the lines
+//follow every move without being rewritten. Lines are added once; show()
+//only rebuilds the list of those drawn.
+class InstanceLines
+{
+public:
+   explicit InstanceLines(const InstancedCubes* cubes) : arrays_dirty(false)
+   {
+      vertices = new osg::Vec3Array;
+      colors = new osg::Vec4Array;
+      lines = new osg::DrawElementsUInt(GL_LINES);
+      geometry = new osg::Geometry();
+      geometry->setVertexArray(vertices.get());
+      geometry->setColorArray(colors.get());
+      geometry->setColorBinding(osg::Geometry::BIND_PER_VERTEX);
+      geometry->addPrimitiveSet(lines.get());
+      geometry->setUseDisplayList(false);
+      geometry->setUseVertexBufferObjects(true);
+      //the vertices hold instance indices, not points
+      geometry->setComputeBoundingBoxCallback(new CubesBounds(cubes));
+
+      geode = new osg::Geode();
+      geode->addDrawable(geometry.get());
+      osg::StateSet* ss = geode->getOrCreateStateSet();
+      osg::Program* program = new osg::Program();
+      program->addShader(new osg::Shader(osg::Shader::VERTEX,vertexShader()));
+      program->addShader(new osg::Shader(osg::Shader::FRAGMENT,fragmentShader()));
+      ss->setAttributeAndModes(program);
+      cubes->sharePositions(ss);
+      ss->setAttributeAndModes(new osg::BlendFunc(GL_SRC_ALPHA,GL_ONE_MINUS_SRC_ALPHA));
+      ss->setAttributeAndModes(new osg::LineWidth(1.5f));
+      ss->setMode(GL_LIGHTING,osg::StateAttribute::OFF);
+      ss->setRenderingHint(osg::StateSet::TRANSPARENT_BIN);
+   }
+
+   osg::Geode* node() const { return geode.get(); }
+
+   uint32_t size() const { return vertices->size()/2; }
+
+   //lines drawn by the last show()
+   uint32_t drawn() const { return lines->size()/2; }
+
+   void clear()
+   {
+      vertices->clear();
+      colors->clear();
+      arrays_dirty = true;
+      lines->clear();
+      lines->dirty();
+   }
+
+   //a line from the center of instance a to the center of instance b; not drawn until show()
+   uint32_t add(uint32_t a, uint32_t b, const osg::Vec4& color)
+   {
+      //16 bits per coordinate, so floats hold them exactly
+      vertices->push_back(osg::Vec3(a & 0xffff,a >> 16,0));
+      vertices->push_back(osg::Vec3(b & 0xffff,b >> 16,0));
+      colors->push_back(color);
+      colors->push_back(color);
+      arrays_dirty = true;
+      return size()-1;
+   }
+
+   //draw the lines k for which shown(k) holds
+   template<class Shown>
+   void show(const Shown& shown)
+   {
+      if(arrays_dirty) {
+         vertices->dirty();
+         colors->dirty();
+         arrays_dirty = false;
+      }
+      lines->clear();
+      for(uint32_t k=0;k<size();++k) {
+         if(!shown(k)) continue;
+         lines->push_back(2*k);
+         lines->push_back(2*k+1);
+      }
+      lines->dirty();
+      geometry->dirtyBound();
+   }
+
+private:
+   class CubesBounds : public osg::Drawable::ComputeBoundingBoxCallback
+   {
+   public:
+      CubesBounds(const InstancedCubes* cubes) : cubes(cubes) {}
+      virtual osg::BoundingBox computeBound(const osg::Drawable&) const { return cubes->bounds(); }
+   private:
+      const InstancedCubes* cubes;
+   };
+
+   static std::string vertexShader()
+   {
+      return "#version 130\n"
+             +InstancedCubes::positionGlsl()+
+             "out vec4 color;\n"
+             "void main() {\n"
+             "   int i = int(gl_Vertex.x + 0.5) + int(gl_Vertex.y + 0.5) * 65536;\n"
+             "   color = gl_Color;\n"
+             "   gl_Position = gl_ModelViewProjectionMatrix * vec4(instancePosition(i) + vec3(0.5), 1.0);\n"
+             "}\n";
+   }
+
+   static std::string fragmentShader()
+   {
+      return "#version 130\n"
+             "in vec4 color;\n"
+             "void main() {\n"
+             "   gl_FragColor = color;\n"
+             "}\n";
+   }
+
+   bool arrays_dirty; //lines added or cleared since the arrays were last uploaded
+   osg::ref_ptr<osg::Vec3Array> vertices; //instance index of each end, in 16-bit halves
+   osg::ref_ptr<osg::Vec4Array> colors;
+   osg::ref_ptr<osg::DrawElementsUInt> lines; //the drawn lines' ends
+   osg::ref_ptr<osg::Geometry> geometry;
+   osg::ref_ptr<osg::Geode> geode;
+};
+
+#endif
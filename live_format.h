@@ -0,0 +1,38 @@
+#ifndef LIVE_FORMAT_H
+#define LIVE_FORMAT_H
+
+#include <stdint.h>
+
+#include "timeline_format.h"
+
+//messages streamcount -live publishes on its ShmRing for pinvis --live
+//
+//Streams are published in id order and never dropped, so a consumer that
+//started with an empty table can use its table index as the stream id.
+//Counts and timeline events are dropped when the ring is full.
+
+enum live_message_type {
+   LIVE_STREAM = 1, //live_stream, sl INT32 Insvals, then the img and rtn names
+   LIVE_COUNTS = 2, //live_count array: executions since the previous LIVE_COUNTS
+   LIVE_TIMELINE = 3, //timeline_chunk_header, then count UINT32 stream ids; each call is also one execution
+   LIVE_END = 4 //the target has exited; no payload
+};
+
+#define LIVE_RING_SIZE (16u<<20) //default ring capacity in bytes
+#define LIVE_TIMELINE_CALLS 4096 //timeline chunks are split into messages of at most this many calls
+
+typedef struct {
+   uint32_t id; //index in the stream table
+   uint32_t sl;
+   uint32_t lscount;
+   uint32_t img_size; //including the terminating NUL
+   uint32_t rtn_size; //including the terminating NUL
+} live_stream;
+
+typedef struct {
+   uint32_t id;
+   uint32_t reserved;
+   uint64_t delta;
+} live_count;
+
+#endif
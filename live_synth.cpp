@@ -0,0 +1,136 @@
+//Synthetic producer for pinvis --live: publishes the same messages as
+//streamcount -live, without Pin, so the viewer side can be run and tested
+//on its own. New streams keep appearing during the run and the calls walk
+//through loops over them; batches alternate between timeline events (as in
+//-mode stream) and count deltas (as in -mode count).
+//
+//usage: live_synth [ring path] [streams] [seconds] [calls per second]
+
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "shm_ring.h"
+#include "live_format.h"
+
+using namespace std;
+
+enum Insval { INS_NORMAL, INS_READ, INS_WRITE };
+
+static double now()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC,&ts);
+   return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+//one LIVE_STREAM message for a made-up stream
+static bool publish_stream(ShmRing* ring, uint32_t id)
+{
+   ostringstream img, rtn;
+   img << "/synthetic/lib" << id%7 << ".so";
+   rtn << "routine" << id%97;
+   live_stream h;
+   h.id = id;
+   h.sl = 1 + rand()%24;
+   h.lscount = 0;
+   vector<int> insvalues(h.sl);
+   for(uint32_t i=0;i<h.sl;++i) {
+      insvalues[i] = rand()%3 == 0 ? (rand()%2 ? INS_READ : INS_WRITE) : INS_NORMAL;
+      if(insvalues[i] != INS_NORMAL) h.lscount++;
+   }
+   h.img_size = img.str().size()+1;
+   h.rtn_size = rtn.str().size()+1;
+
+   vector<char> msg(sizeof(h)+sizeof(int)*h.sl+h.img_size+h.rtn_size);
+   char* p = &msg[0];
+   memcpy(p,&h,sizeof(h));
+   p += sizeof(h);
+   memcpy(p,&insvalues[0],sizeof(int)*h.sl);
+   p += sizeof(int)*h.sl;
+   memcpy(p,img.str().c_str(),h.img_size);
+   p += h.img_size;
+   memcpy(p,rtn.str().c_str(),h.rtn_size);
+   return ring->push(LIVE_STREAM,&msg[0],msg.size());
+}
+
+int main(int argc, char** argv)
+{
+   const char* path = argc>1 ? argv[1] : "/dev/shm/pinvis_live";
+   uint32_t streams = argc>2 ? atoi(argv[2]) : 2000;
+   double seconds = argc>3 ? atof(argv[3]) : 30;
+   uint32_t rate = argc>4 ? atoi(argv[4]) : 1000000;
+
+   ShmRing* ring = ShmRing::create(path,LIVE_RING_SIZE);
+   if(ring == NULL) {
+      cerr << "live_synth: could not create " << path << endl;
+      return 1;
+   }
+
+   //like streamcount: a batch of calls every 100ms, new streams published
+   //first (retried while the ring is full), then the calls
+   srand(1);
+   uint32_t published = 0;
+   uint64_t calls = 0;
+   uint32_t current = 0;
+   uint32_t batches = 0;
+   vector<uint32_t> batch;
+   vector<uint64_t> counts;
+   double start = now();
+   while(now()-start < seconds) {
+      double elapsed = now()-start;
+      uint32_t known = (uint32_t)(streams*(elapsed+0.1)/seconds);
+      if(known > streams) known = streams;
+      while(published < known && publish_stream(ring,published)) published++;
+
+      //loops: a stream repeats a few times, then control moves on
+      batch.clear();
+      counts.assign(published,0);
+      while(published > 0 && batch.size() < rate/10) {
+         uint32_t trips = 1 + rand()%16;
+         for(uint32_t i=0;i<trips;++i) batch.push_back(current);
+         counts[current] += trips;
+         current = rand()%published;
+      }
+      calls += batch.size();
+      if(batches++ % 2 == 0) {
+         for(uint32_t first=0;first<batch.size();first+=LIVE_TIMELINE_CALLS) {
+            timeline_chunk_header header;
+            header.tid = 0;
+            header.count = batch.size()-first < LIVE_TIMELINE_CALLS ? batch.size()-first : LIVE_TIMELINE_CALLS;
+            vector<char> msg(sizeof(header)+sizeof(uint32_t)*header.count);
+            memcpy(&msg[0],&header,sizeof(header));
+            memcpy(&msg[sizeof(header)],&batch[first],sizeof(uint32_t)*header.count);
+            if(!ring->push(LIVE_TIMELINE,&msg[0],msg.size())) ring->drop(msg.size());
+         }
+      }
+      else {
+         vector<live_count> deltas;
+         for(uint32_t id=0;id<published;++id) {
+            live_count d;
+            d.id = id;
+            d.reserved = 0;
+            d.delta = counts[id];
+            if(d.delta) deltas.push_back(d);
+         }
+         for(uint32_t first=0;first<deltas.size();first+=LIVE_TIMELINE_CALLS) {
+            uint32_t n = deltas.size()-first < LIVE_TIMELINE_CALLS ? deltas.size()-first : LIVE_TIMELINE_CALLS;
+            if(!ring->push(LIVE_COUNTS,&deltas[first],sizeof(live_count)*n)) ring->drop(sizeof(live_count)*n);
+         }
+      }
+      usleep(100000);
+   }
+   ring->push(LIVE_END,"",0);
+
+   cout << "streams: " << published << endl;
+   cout << "calls: " << calls << endl;
+   cout << "dropped messages: " << ring->dropped() << endl;
+   delete ring;
+   return 0;
+}
@@ -0,0 +1,233 @@
+#ifndef LOD_H
+#define LOD_H
+
+#include <stdint.h>
+#include <math.h>
+#include <map>
+#include <vector>
+
+//Level of detail for pinvis's grid layout. The grid is placed tile by
+//tile: TILE x TILE consecutive streams fill a tile, and the tiles fill a
+//square, so a tile's streams (and their cubes) are contiguous. Tiles are
+//grouped into regions of REGION x REGION tiles. build() sums up every tile
+//and region once; update() then decides from the eye position which
+//regions are open and, in open regions, which tiles show their streams.
+//Everything else is drawn as one aggregate block per tile or region, so
+//the work per frame follows what is near the eye, not the trace size.
+
+//a stream as the LOD sees it
+typedef struct {
+   uint32_t sl;
+   uint32_t img; //interned name ids
+   uint32_t rtn;
+   uint64_t scount;
+} lod_stream;
+
+//a tile or region summed up
+typedef struct {
+   float row; //footprint in grid cells: [row,row+size) x [col,col+size)
+   float col;
+   float size;
+   uint32_t streams;
+   uint64_t instructions;
+   uint64_t scount; //executions of all its streams
+   uint32_t img; //image and routine holding most of its instructions
+   uint32_t rtn;
+   bool shown; //drawn as an aggregate block
+} lod_aggregate;
+
+class GridLod
+{
+public:
+   enum { TILE = 16, TILE_STREAMS = TILE*TILE, REGION = 16 }; //REGION is in tiles
+
+   GridLod() : expand_distance(6*TILE), open_distance(2*TILE*REGION) {}
+
+   //tiles per side of the square holding n streams
+   static uint32_t tiles_per_side(uint64_t n)
+   {
+      uint64_t ntiles = (n+TILE_STREAMS-1)/TILE_STREAMS;
+      uint32_t side = (uint32_t)ceil(sqrt((double)ntiles));
+      return side ? side : 1;
+   }
+
+   //grid cells per side of the square holding n streams
+   static uint32_t side(uint64_t n) { return tiles_per_side(n)*TILE; }
+
+   //cell of stream i when n streams are placed
+   static void place(uint64_t i, uint64_t n, uint32_t* row, uint32_t* col)
+   {
+      uint32_t t = i/TILE_STREAMS, s = i%TILE_STREAMS;
+      uint32_t side = tiles_per_side(n);
+      *row = (t%side)*TILE+s%TILE;
+      *col = (t/side)*TILE+s/TILE;
+   }
+
+   //sum up the tiles and regions of streams placed as n streams
+   void build(const std::vector<lod_stream>& streams, uint64_t n)
+   {
+      side_tiles = tiles_per_side(n);
+      side_regions = (side_tiles+REGION-1)/REGION;
+      uint32_t ntiles = (streams.size()+TILE_STREAMS-1)/TILE_STREAMS;
+      tiles.assign(ntiles,empty_aggregate());
+      expanded.assign(ntiles,true);
+      regions.assign(side_regions*side_regions,empty_aggregate());
+      region_open.assign(regions.size(),true);
+      region_tiles.assign(regions.size(),std::vector<uint32_t>());
+
+      std::vector<std::map<uint32_t,uint64_t> > region_imgs(regions.size());
+      for(uint32_t t=0;t<ntiles;++t) {
+         lod_aggregate& a = tiles[t];
+         a.row = (t%side_tiles)*TILE;
+         a.col = (t/side_tiles)*TILE;
+         a.size = TILE;
+         uint32_t r = region_of(t);
+         region_tiles[r].push_back(t);
+         std::map<uint32_t,uint64_t> rtns, imgs;
+         for(uint64_t i=(uint64_t)t*TILE_STREAMS;i<streams.size() && i<(uint64_t)(t+1)*TILE_STREAMS;++i) {
+            const lod_stream& s = streams[i];
+            a.streams++;
+            a.instructions += s.sl;
+            a.scount += s.scount;
+            rtns[s.rtn] += s.sl;
+            imgs[s.img] += s.sl;
+            region_imgs[r][s.img] += s.sl;
+         }
+         a.rtn = top(rtns);
+         a.img = top(imgs);
+         lod_aggregate& g = regions[r];
+         g.streams += a.streams;
+         g.instructions += a.instructions;
+         g.scount += a.scount;
+      }
+      for(uint32_t r=0;r<regions.size();++r) {
+         lod_aggregate& g = regions[r];
+         g.row = (r%side_regions)*REGION*TILE;
+         g.col = (r/side_regions)*REGION*TILE;
+         g.size = REGION*TILE;
+         g.img = top(region_imgs[r]);
+         //the routine of the region's biggest tile
+         uint64_t most = 0;
+         for(size_t k=0;k<region_tiles[r].size();++k) {
+            const lod_aggregate& a = tiles[region_tiles[r][k]];
+            if(a.instructions > most) {
+               most = a.instructions;
+               g.rtn = a.rtn;
+            }
+         }
+      }
+   }
+
+   //open regions and expand tiles near the eye, given in grid cells (row,
+   //col) and height (y, columns hang down from 1). Tiles whose streams
+   //appear or disappear are added to *changed; true if an aggregate
+   //block appeared or disappeared.
+   bool update(float row, float y, float col, std::vector<uint32_t>* changed)
+   {
+      bool blocks_changed = false;
+      for(uint32_t r=0;r<regions.size();++r) {
+         lod_aggregate& g = regions[r];
+         if(g.streams == 0) continue;
+         bool open = distance(g,row,y,col) < open_distance;
+         bool toggled = open != region_open[r];
+         if(toggled) {
+            region_open[r] = open;
+            g.shown = !open;
+            blocks_changed = true;
+         }
+         //tiles of closed regions are only visited when the region closes
+         if(!open && !toggled) continue;
+         for(size_t k=0;k<region_tiles[r].size();++k) {
+            uint32_t t = region_tiles[r][k];
+            lod_aggregate& a = tiles[t];
+            bool expand = open && distance(a,row,y,col) < expand_distance;
+            bool shown = open && !expand;
+            if(expand != expanded[t]) {
+               expanded[t] = expand;
+               changed->push_back(t);
+            }
+            if(shown != a.shown) {
+               a.shown = shown;
+               blocks_changed = true;
+            }
+         }
+      }
+      return blocks_changed;
+   }
+
+   //show every stream and no aggregate, as before build()
+   void expand_all(std::vector<uint32_t>* changed)
+   {
+      for(uint32_t t=0;t<tiles.size();++t) {
+         if(!expanded[t]) changed->push_back(t);
+         expanded[t] = true;
+         tiles[t].shown = false;
+      }
+      for(uint32_t r=0;r<regions.size();++r) {
+         region_open[r] = true;
+         regions[r].shown = false;
+      }
+   }
+
+   //how far an aggregate's block hangs down from y=1: log2 of its total
+   //instructions (at least 1), so height stands for size and a region's
+   //block stays within a few cubes of its tiles'
+   static float depth(const lod_aggregate& a)
+   {
+      return a.instructions > 2 ? (float)(log((double)a.instructions)/log(2.0)) : 1.0f;
+   }
+
+   //tile of stream i; its streams are [t*TILE_STREAMS,(t+1)*TILE_STREAMS)
+   static uint32_t tile_of(uint64_t i) { return i/TILE_STREAMS; }
+
+   //true if the streams of tile t are drawn; streams beyond build() always are
+   bool tile_expanded(uint32_t t) const { return t >= expanded.size() || expanded[t]; }
+
+   std::vector<lod_aggregate> tiles;
+   std::vector<lod_aggregate> regions;
+   float expand_distance; //a tile shows its streams when the eye is this close
+   float open_distance; //a region shows its tiles when the eye is this close
+
+private:
+   static lod_aggregate empty_aggregate()
+   {
+      lod_aggregate a = { 0, 0, 0, 0, 0, 0, 0, 0, false };
+      return a;
+   }
+
+   static uint32_t top(const std::map<uint32_t,uint64_t>& counts)
+   {
+      uint32_t id = 0;
+      uint64_t most = 0;
+      for(std::map<uint32_t,uint64_t>::const_iterator it=counts.begin();it!=counts.end();++it) {
+         if(it->second > most) {
+            most = it->second;
+            id = it->first;
+         }
+      }
+      return id;
+   }
+
+   uint32_t region_of(uint32_t t) const
+   {
+      return (t%side_tiles)/REGION+((t/side_tiles)/REGION)*side_regions;
+   }
+
+   //from the eye to the aggregate's block: its footprint, hanging down from
+   //y=1 by depth()
+   static float distance(const lod_aggregate& a, float row, float y, float col)
+   {
+      float d[3] = { gap(row,a.row,a.row+a.size), gap(y,1-depth(a),1), gap(col,a.col,a.col+a.size) };
+      return sqrtf(d[0]*d[0]+d[1]*d[1]+d[2]*d[2]);
+   }
+
+   static float gap(float x, float lo, float hi) { return x < lo ? lo-x : (x > hi ? x-hi : 0); }
+
+   uint32_t side_tiles;
+   uint32_t side_regions;
+   std::vector<bool> expanded; //by tile: its streams are drawn
+   std::vector<bool> region_open; //by region: its tiles are drawn, as streams or blocks
+   std::vector<std::vector<uint32_t> > region_tiles;
+};
+
+#endif
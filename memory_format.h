@@ -0,0 +1,45 @@
+#ifndef MEMORY_FORMAT_H
+#define MEMORY_FORMAT_H
+
+#include <stdint.h>
+
+//memory.bin layout, shared by streamcount -memory (writer) and pinvis (reader)
+//
+//UINT32 MEMORY_MAGIC, UINT32 MEMORY_VERSION, UINT32 page shift, UINT32 line
+//shift, UINT32 record count, then for each stream that accessed memory a
+//memory_stream_header followed by npages <UINT64 page,UINT64 accesses> pairs
+//and nlines <UINT64 cache line,UINT64 accesses> pairs. Pages and lines are
+//addresses shifted right by the page and line shift.
+
+#define MEMORY_MAGIC 0x4d4d5650u //"PVMM"
+#define MEMORY_VERSION 1
+#define MEMORY_PAGE_SHIFT 12
+#define MEMORY_LINE_SHIFT 6
+#define MEMORY_STRIDE_BUCKETS 16
+
+typedef struct {
+   uint32_t id; //index in the stream table
+   uint32_t npages; //distinct pages touched
+   uint32_t nlines; //distinct cache lines touched
+   uint32_t reserved;
+   uint64_t reads;
+   uint64_t writes;
+   //distance between consecutive accesses within one execution of the
+   //stream, bucketed by stride_bucket()
+   uint64_t strides[MEMORY_STRIDE_BUCKETS];
+} memory_stream_header;
+
+//bucket 0: same address, bucket b: |stride| in [2^(b-1),2^b), the last
+//bucket also takes everything larger
+inline uint32_t stride_bucket(uint64_t a, uint64_t b)
+{
+   uint64_t stride = a > b ? a-b : b-a;
+   uint32_t bucket = 0;
+   while(stride != 0 && bucket < MEMORY_STRIDE_BUCKETS-1) {
+      stride >>= 1;
+      bucket++;
+   }
+   return bucket;
+}
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef NAME_TABLE_H
+#define NAME_TABLE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <tr1/unordered_map>
+
+//Interns image and routine names: each distinct name is stored once and
+//identified by its index, which is what stream records refer to.
+class NameTable
+{
+public:
+   //index of name, adding it if it has not been seen
+   uint32_t intern(const std::string& name)
+   {
+      std::tr1::unordered_map<std::string,uint32_t>::iterator it = ids.find(name);
+      if(it != ids.end()) return it->second;
+      uint32_t id = names.size();
+      names.push_back(name);
+      ids.insert(std::make_pair(name,id));
+      return id;
+   }
+
+   const std::string& name(uint32_t id) const { return names[id]; }
+
+   uint32_t size() const { return names.size(); }
+
+private:
+   std::tr1::unordered_map<std::string,uint32_t> ids;
+   std::vector<std::string> names;
+};
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stdint.h>
+#include <vector>
+#include <pthread.h>
+#include <unistd.h>
+
+//Runs tasks[i].run(begin,end) on its own thread for the i-th of
+//tasks.size() equal slices of [0,n), and waits for all of them. Each task
+//accumulates into its own members and the caller merges them afterwards,
+//so nothing is shared while the threads run.
+
+template<class Task>
+struct parallel_slice {
+   Task* task;
+   uint64_t begin;
+   uint64_t end;
+};
+
+template<class Task>
+static void* parallel_thread(void* arg)
+{
+   parallel_slice<Task>* slice = static_cast<parallel_slice<Task>*>(arg);
+   slice->task->run(slice->begin,slice->end);
+   return NULL;
+}
+
+template<class Task>
+void parallel_for(std::vector<Task>& tasks, uint64_t n)
+{
+   uint64_t k = tasks.size();
+   std::vector<parallel_slice<Task> > slices(k);
+   std::vector<pthread_t> threads(k);
+   std::vector<bool> started(k,false);
+   for(uint64_t i=0;i<k;++i) {
+      slices[i].task = &tasks[i];
+      slices[i].begin = n*i/k;
+      slices[i].end = n*(i+1)/k;
+   }
+   //the calling thread takes the first slice; a slice whose thread cannot
+   //be started runs on the calling thread too
+   for(uint64_t i=1;i<k;++i) {
+      started[i] = pthread_create(&threads[i],NULL,parallel_thread<Task>,&slices[i]) == 0;
+   }
+   if(k > 0) parallel_thread<Task>(&slices[0]);
+   for(uint64_t i=1;i<k;++i) {
+      if(started[i]) pthread_join(threads[i],NULL);
+      else parallel_thread<Task>(&slices[i]);
+   }
+}
+
+//number of online cores, at least 1
+inline unsigned parallel_cores()
+{
+   long n = sysconf(_SC_NPROCESSORS_ONLN);
+   return n > 0 ? (unsigned)n : 1;
+}
+
+#endif
@@ -4,16 +4,15 @@
 #include <osg/Geometry>
 #include <osg/Material>
 #include <osg/Texture2D>
-#include <osg/AnimationPath>
 #include <osgDB/ReadFile> 
 #include <osgViewer/Viewer>
-#include <osg/PositionAttitudeTransform>
 #include <osgGA/TrackballManipulator>
 #include <osgGA/UFOManipulator>
 #include <osgGA/KeySwitchMatrixManipulator>
-#include <osg/ShapeDrawable>
 #include <osgText/Text>
 #include <osg/io_utils>
+#include <osg/Timer>
+#include <osg/Viewport>
 
 #include <iostream>
 #include <sstream>
@@ -23,47 +22,126 @@
 #include <algorithm>
 #include <vector>
 #include <math.h>
+#include <deque>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "timeline_format.h"
+#include "timeline_reader.h"
+#include "streamcount_format.h"
+#include "pvformat.h"
+#include "memory_format.h"
+#include "shm_ring.h"
+#include "live_format.h"
+#include "instanced_cubes.h"
+#include "filter.h"
+#include "lod.h"
+#include "transitions.h"
+#include "force_layout.h"
 
 using namespace std;
 
 typedef uint32_t UINT32;
+typedef uint64_t UINT64;
+typedef int64_t INT64;
 typedef UINT32 ADDRINT;
 
 typedef struct {
+   UINT32 id; //index in the input
    UINT32 sl; //stream length
-   int* insvalues; //array of Insvals, one for each instruction
-   UINT32 scount; //stream count -- how many times it has been executed
+   const uint8_t* insvalues; //packed Insvals, read with insval()
+   UINT64 insval_first; //index of the stream's first Insval in insvalues
+   UINT64 scount; //stream count -- how many times it has been executed
    UINT32 lscount; //number of memory-referencing instructions
    UINT32 nstream; //number of unique next streams
-   char* img_name;
-   char* rtn_name;
-   map<UINT32,UINT32> next_stream; //<stream index,times executed> count how many times the next stream is encountered
-   osg::PositionAttitudeTransform** transforms; //array of transforms, one transform per instruction
-   osg::AnimationPath** animationPaths; //array of animation paths, one path per instruction
-   bool hidden;
+   UINT32 img; //interned name ids, index name_by_id
+   UINT32 rtn;
+   const char* img_name;
+   const char* rtn_name;
+   const pv_edge* next_stream; //<stream index,times executed> for each next stream
+   UINT32 index; //in stream_table, which is also the order of placement
+   UINT32 first_instance; //cube of instruction j is instance first_instance+j
+   bool hidden; //filtered out: its cubes are not drawn
+   bool drawn; //its cubes are drawn, as drawStream last left them
+   float heat; //trail of timeline playback: 1 when just called, fading to 0
+   int heat_level; //heat as last painted, 0 once cooled
+   bool has_memory; //memory file has a record for this stream
+   UINT32 mem_lines; //distinct cache lines accessed
+   double mem_far; //fraction of strides that leave the cache line
 } stream_table_entry;
 
 typedef pair<ADDRINT,UINT32> key; //<address of block,length of block>
 typedef map<key,UINT32> stream_map; //<block key,index in stream_table>
 
 enum Insval { INS_NORMAL, INS_READ, INS_WRITE };
-enum PlacementScheme { GRID_LAYOUT, ROW_LAYOUT };
-enum ColorScheme { MEMORY_COLORING, EXECUTION_FREQ_COLORING };
+enum PlacementScheme { GRID_LAYOUT, ROW_LAYOUT, FORCE_LAYOUT };
+enum ColorScheme { MEMORY_COLORING, EXECUTION_FREQ_COLORING, FOOTPRINT_COLORING, STRIDE_COLORING };
 enum HideScheme { HIDE, HIDE_ALL_ELSE };
 
+//Insval of instruction j of stream e
+inline int insval(const stream_table_entry* e, UINT32 j) { return pv_insval(e->insvalues,e->insval_first+j); }
+
 static stream_map stream_ids; //maps block keys to their index in the stream_table
 static vector<stream_table_entry*> stream_table; //one entry for each unique (by address & length) block
-static vector<osg::Node*> highlighted; //nodes that are currently highlighted by the picking code
-static vector<UINT32> stream_call_order;
+static PvFile* streamcount_file; //the mapped input file; entries point into it
+static vector<stream_table_entry*> stream_by_id; //indexed by id, NULL until loaded
+static UINT64 layout_size = 0; //streams the layout makes room for, so loading does not move placed streams
+static InstancedCubes* cubes; //one cube instance per instruction of every stream
+static vector<const char*> name_by_id; //image and routine names by interned id
+static map<string,UINT32> live_names; //pinvis --live: name -> id
+static FilterSet filters; //which streams are shown
+static vector<UINT32> instance_stream; //stream_table index of each cube instance
+static stream_table_entry* highlighted = NULL; //stream last picked
+static GridLod lod; //tiles and regions of the grid layout, summed up once loading is done
+static bool lod_active = false; //far tiles and regions are drawn as aggregate blocks
+static osg::ref_ptr<osg::Geometry> aggregates = new osg::Geometry; //a block per tile and region; only the shown ones are drawn
+static InstanceLines* transition_lines; //a line per selected transition between streams
+static vector<transition> transitions; //the selected transitions, in line order
+static bool transitions_dirty = false; //streams were drawn or hidden since the lines were shown
+static UINT64 transition_min_count = 1; //transitions taken fewer times are not drawn
+static UINT32 transition_top = 3; //most transitions drawn per stream, 0 for all
+static TimelineReader timelines; //stream call order, one per target thread, decoded a chunk at a time
+static int current_timeline = 0;
+static INT64 current_stream_call = -1;
+static VisibleCalls visible_calls; //calls of current_timeline to shown streams
+static bool visible_calls_valid = false; //cleared when filters, loading or the thread change what is shown
+static INT64 current_visible = -1; //index in visible_calls of the shown call at or after current_stream_call
+static bool current_between = false; //current_stream_call is not shown; it lies just before current_visible
+static bool playing = false; //the timeline steps on by itself (r)
+static double play_rate = 1000; //calls per second while playing
+static double play_carry = 0; //calls due but not played yet
+static double play_time = 0; //when playTimeline last ran
+static vector<stream_table_entry*> hot_streams; //streams with a heat trail still fading
 static int currentColoring = MEMORY_COLORING;
+static UINT64 color_min_scount = 0; //scales of the current coloring, over the whole table
+static UINT64 color_max_scount = 0;
+static bool color_scale_rounded = false; //pinvis --live: color_max_scount is rounded up to a power of two
+static double color_max_lines = 1;
+static stream_table_entry* timeline_stream = NULL; //stream stepped to with n/p, shown in blue
+static int currentPlacement = GRID_LAYOUT;
 static osg::ref_ptr<osgText::Text> updateText = new osgText::Text;
 
-void setColor(osg::Node*,float r, float g, float b);
-void placeStreams(int scheme);
-void colorStreams(int scheme);
+void setStreamColor(stream_table_entry* e, float r, float g, float b);
+void placeStreams(int scheme, int first = 0);
+void colorStreams(int scheme, int first = 0);
+void colorStream(stream_table_entry* e);
+void showTimelineStream(stream_table_entry* e);
 void hideByImage(int scheme);
-void moveToInfinity(int stream_table_index);
+void applyFilters();
+void drawStream(stream_table_entry* e);
+void showAggregates();
+void expandAll();
 void updateTimeline(int steps);
+void selectTimeline(int steps);
+void seekTimeline(int tenths);
+void paintStream(stream_table_entry* e);
+void selectTransitions();
+void loadMemory(const char* filename);
+stream_table_entry* streamById(UINT64 id);
+string pickAggregate(const osg::Vec3& start, const osg::Vec3& end);
+string streamLabel(const stream_table_entry* e);
+static double now() { return osg::Timer::instance()->time_s(); }
 
 // class to handle events with a pick
 class PickHandler : public osgGA::GUIEventHandler {
@@ -115,40 +193,60 @@ bool PickHandler::handle(const osgGA::GUIEventAdapter& ea,osgGA::GUIActionAdapte
     }
 }
 
-void PickHandler::pick(osgViewer::View* view, const osgGA::GUIEventAdapter& ea)
+//label of the nearest aggregate block on the segment start-end, "" if none
+string pickAggregate(const osg::Vec3& start, const osg::Vec3& end) {
+   float half = GridLod::side(layout_size)/2;
+   osg::Vec3 dir = end-start;
+   const lod_aggregate* nearest = NULL;
+   float nearest_t = 2;
+   for(int level=0;level<2;++level) {
+      const vector<lod_aggregate>& v = level ? lod.regions : lod.tiles;
+      for(size_t k=0;k<v.size();++k) {
+         const lod_aggregate& a = v[k];
+         if(!a.shown) continue;
+         float lo[3] = { a.row-half, 1-GridLod::depth(a), a.col-half };
+         float hi[3] = { a.row+a.size-half, 1, a.col+a.size-half };
+         float t, t_out;
+         if(InstanceGrid::segment_box(start.ptr(),dir.ptr(),lo,hi,&t,&t_out) && t < nearest_t) {
+            nearest_t = t;
+            nearest = &a;
+         }
+      }
+   }
+   if(nearest == NULL) return "";
+   ostringstream label;
+   label << nearest->streams << " streams, " << nearest->instructions << " instructions, executed "
+         << nearest->scount << " times, mostly " << name_by_id[nearest->rtn] << " in " << name_by_id[nearest->img];
+   return label.str();
+}
+
+//cast a ray through (x,y) in normalized window coordinates and hit test the
+//cubes on the CPU; highlights the stream hit and returns its label
+string pickLabel(osg::Camera* camera, float x, float y)
 {
-    osgUtil::LineSegmentIntersector::Intersections intersections;
+    osg::Matrix inverse = osg::Matrix::inverse(camera->getViewMatrix()*camera->getProjectionMatrix());
+    osg::Vec3 start = osg::Vec3(x,y,-1.0f)*inverse;
+    osg::Vec3 end = osg::Vec3(x,y,1.0f)*inverse;
 
     std::string gdlist="";
-    float x = ea.getX();
-    float y = ea.getY();
-    if (view->computeIntersections(x,y,intersections))
+    UINT32 instance = cubes->pick(start,end,now());
+    if (instance != InstancedCubes::NO_INSTANCE)
     {
-        for(osgUtil::LineSegmentIntersector::Intersections::iterator hitr = intersections.begin();
-            hitr != intersections.end();
-            ++hitr)
-        {
-            std::ostringstream os;
-            if(hitr->nodePath.size() >= 2) {
-                osg::Node *node = hitr->nodePath[hitr->nodePath.size()-2];
-                os << node->getName()<<"\""<<endl;
-                highlighted.push_back(node);
-            }
-            else if (!hitr->nodePath.empty() && !(hitr->nodePath.back()->getName().empty()))
-            {
-                // the geodes are identified by name.
-                os<<"Object \""<<hitr->nodePath.back()->getName()<<"\""<<std::endl;
-            }
-            else if (hitr->drawable.valid())
-            {
-                os<<"Object \""<<hitr->drawable->className()<<"\""<<std::endl;
-            }
-
-            gdlist += os.str();
-            break; //for now just grab the first intersection; seems to be the closest to camera anyway
-        }
+        highlighted = stream_table[instance_stream[instance]];
+        std::ostringstream os;
+        os << streamLabel(highlighted) << " instruction " << instance-highlighted->first_instance << "\"" << endl;
+        gdlist = os.str();
+    }
+    else if (lod_active)
+    {
+        gdlist = pickAggregate(start,end);
     }
-    setLabel(gdlist);
+    return gdlist;
+}
+
+void PickHandler::pick(osgViewer::View* view, const osgGA::GUIEventAdapter& ea)
+{
+    setLabel(pickLabel(view->getCamera(),ea.getXnormalized(),ea.getYnormalized()));
 }
 
 class KeyboardEventHandler : public osgGA::GUIEventHandler
@@ -168,10 +266,18 @@ bool KeyboardEventHandler::handle(const osgGA::GUIEventAdapter& ea,osgGA::GUIAct
           {
              case '1':
                 placeStreams(GRID_LAYOUT);
+                //the next frame collapses what is far away again
+                lod_active = !lod.tiles.empty();
                 return false;
                 break;
              case '2':
                 placeStreams(ROW_LAYOUT);
+                expandAll();
+                return false;
+                break;
+             case '5':
+                placeStreams(FORCE_LAYOUT);
+                expandAll();
                 return false;
                 break;
              case '3':
@@ -182,6 +288,14 @@ bool KeyboardEventHandler::handle(const osgGA::GUIEventAdapter& ea,osgGA::GUIAct
                 colorStreams(EXECUTION_FREQ_COLORING);
                 return false;
                 break;
+             case '6':
+                colorStreams(FOOTPRINT_COLORING);
+                return false;
+                break;
+             case '7':
+                colorStreams(STRIDE_COLORING);
+                return false;
+                break;
              case 'h':
                 hideByImage(HIDE);
                 return false;
@@ -190,6 +304,16 @@ bool KeyboardEventHandler::handle(const osgGA::GUIEventAdapter& ea,osgGA::GUIAct
                 hideByImage(HIDE_ALL_ELSE);
                 return false;
                 break;
+             case 'z':
+                filters.pop();
+                applyFilters();
+                return false;
+                break;
+             case 'a':
+                filters.clear();
+                applyFilters();
+                return false;
+                break;
              case 'n':
                 updateTimeline(1);
                 return false;
@@ -198,6 +322,51 @@ bool KeyboardEventHandler::handle(const osgGA::GUIEventAdapter& ea,osgGA::GUIAct
                 updateTimeline(-1);
                 return false;
                 break;
+             case 't':
+                selectTimeline(1);
+                return false;
+                break;
+             case '[':
+                seekTimeline(-1);
+                return false;
+                break;
+             case ']':
+                seekTimeline(1);
+                return false;
+                break;
+             case 'e':
+                transition_lines->node()->setNodeMask(transition_lines->node()->getNodeMask() ? 0 : ~0u);
+                return false;
+                break;
+             case '>':
+                transition_min_count *= 2;
+                selectTransitions();
+                return false;
+                break;
+             case '<':
+                transition_min_count = max((UINT64)1,transition_min_count/2);
+                selectTransitions();
+                return false;
+                break;
+             case 'k':
+                //1, 3, 10, all
+                transition_top = transition_top == 0 ? 1 : (transition_top < 3 ? 3 : (transition_top < 10 ? 10 : 0));
+                selectTransitions();
+                return false;
+                break;
+             case 'r':
+                playing = !playing;
+                play_carry = 0;
+                return false;
+                break;
+             case '+':
+                play_rate *= 2;
+                return false;
+                break;
+             case '-':
+                play_rate = max(1.0,play_rate/2);
+                return false;
+                break;
              default:
                 return false;
           }
@@ -207,14 +376,11 @@ bool KeyboardEventHandler::handle(const osgGA::GUIEventAdapter& ea,osgGA::GUIAct
    }
 }
 
-void setColor(osg::Node* node,float r, float g, float b) {
-   osg::StateSet *ss = node->getOrCreateStateSet();
-   osg::Material *nm = new osg::Material;
-   nm->setDiffuse(osg::Material::FRONT,osg::Vec4(r,g,b,1.0f));
-   ss->setAttribute(nm);
+void setStreamColor(stream_table_entry* e, float r, float g, float b) {
+   for(UINT32 j=0;j<e->sl;++j) cubes->setColor(e->first_instance+j,r,g,b);
 }
 
-osg::Vec4 rgbInterp(int min_l, int max_l, int curr_l) {
+osg::Vec4 rgbInterp(double min_l, double max_l, double curr_l) {
    double total_size = max_l - min_l;
    double curr_size = curr_l - min_l;
    double interp = curr_size/total_size;
@@ -279,70 +445,292 @@ osg::Node* createHUD(osgText::Text* updateText)
     return hudCamera;
 }
 
+//streams loaded and not filtered out, by id, for indexing the timeline
+typedef struct ShownStream {
+   bool operator()(UINT32 id) const {
+      stream_table_entry* e = streamById(id);
+      return e != NULL && !e->hidden;
+   }
+} ShownStream;
+
+//the shown calls of the current timeline, reindexed if what is shown has
+//changed and extended by calls appended since (pinvis --live)
+VisibleCalls& visibleCalls() {
+   if(!visible_calls_valid) {
+      visible_calls.clear();
+      visible_calls_valid = true;
+      current_visible = -1;
+   }
+   if(timelines.threads()>0 && visible_calls.calls_indexed() < timelines.calls(current_timeline)) {
+      bool placed = current_visible >= 0 || current_stream_call < 0;
+      visible_calls.extend(timelines,current_timeline,ShownStream());
+      //after reindexing, pick up at the current call, or between the shown calls around it
+      if(!placed) current_visible = visible_calls.locate(current_stream_call,&current_between);
+   }
+   return visible_calls;
+}
+
+//move steps shown calls on, wrapping around; false if no shown stream is called
+bool stepTimeline(INT64 steps) {
+   VisibleCalls& calls = visibleCalls();
+   INT64 n = calls.size();
+   if(n == 0) return false;
+   current_visible = calls.step(current_visible,current_between,steps);
+   current_between = false;
+   current_stream_call = calls.call(current_visible);
+   return true;
+}
+
+stream_table_entry* currentTimelineStream() {
+   return streamById(timelines.call(current_timeline,current_stream_call));
+}
+
 void updateTimeline(int steps) {
-   if(stream_call_order.size()<1) return;
+   if(timelines.threads()<1) return;
+   if(!stepTimeline(steps)) {
+      updateText->setText("no shown stream is called in this timeline");
+      return;
+   }
+   stream_table_entry* e = currentTimelineStream();
+
+   //only the previous and the new stream are recolored
+   updateText->setText(streamLabel(e));
+   showTimelineStream(e);
+}
 
-   static int current_stream_call = -1;
-   int prev_stream_call = max(0,current_stream_call);
+//jump a tenth of the shown calls per step
+void seekTimeline(int tenths) {
+   if(timelines.threads()<1) return;
+   INT64 steps = (INT64)visibleCalls().size()*tenths/10;
+   updateTimeline(steps ? steps : tenths);
+}
 
-   colorStreams(currentColoring);
+//Playback (r): the timeline steps on at play_rate calls per second, up to
+//PLAY_FRAME_CALLS a frame. Every stream called leaves a heat trail, from
+//yellow to red over about HEAT_FADE_SECONDS; heat is painted in
+//HEAT_LEVELS steps, so a stream is recolored a few times as it cools
+//rather than every frame.
+#define PLAY_FRAME_CALLS (1<<20)
+#define HEAT_FADE_SECONDS 0.5
+#define HEAT_LEVELS 8
+
+void heatStream(stream_table_entry* e) {
+   if(e->heat == 0) hot_streams.push_back(e);
+   e->heat = 1;
+}
 
-   do {
-      current_stream_call+=steps;
-      if(current_stream_call<0) {
-         current_stream_call = stream_call_order.size()-1;
+//fade the trail by elapsed seconds; streams repainted only when their level changes
+void coolStreams(double elapsed) {
+   float fade = exp(-elapsed/HEAT_FADE_SECONDS);
+   size_t kept = 0;
+   for(size_t i=0;i<hot_streams.size();++i) {
+      stream_table_entry* e = hot_streams[i];
+      e->heat *= fade;
+      int level = (int)(e->heat*HEAT_LEVELS);
+      if(level != e->heat_level) {
+         e->heat_level = level;
+         paintStream(e);
       }
-      else if(current_stream_call>stream_call_order.size()-1) {
-         current_stream_call = 0;
+      if(level > 0) hot_streams[kept++] = e;
+      else e->heat = 0;
+   }
+   hot_streams.resize(kept);
+}
+
+//play the calls due since the last frame; render thread, once a frame
+void playTimeline(double t) {
+   double elapsed = t-play_time;
+   play_time = t;
+   if(playing && timelines.threads()>0) {
+      play_carry = min(play_carry+elapsed*play_rate,(double)PLAY_FRAME_CALLS);
+      INT64 due = (INT64)play_carry;
+      play_carry -= due;
+      stream_table_entry* e = NULL;
+      for(INT64 i=0;i<due;++i) {
+         if(!stepTimeline(1)) {
+            playing = false;
+            updateText->setText("no shown stream is called in this timeline");
+            break;
+         }
+         e = currentTimelineStream();
+         heatStream(e);
+      }
+      if(e) {
+         ostringstream label;
+         label << "thread " << timelines.tid(current_timeline) << " call " << current_stream_call
+               << " of " << timelines.calls(current_timeline) << ", " << play_rate << " calls/s: " << streamLabel(e);
+         updateText->setText(label.str());
+         showTimelineStream(e);
+      }
+   }
+   coolStreams(elapsed);
+}
+
+//switch the timeline stepped by n/p to the next target thread
+void selectTimeline(int steps) {
+   if(timelines.threads()<1) return;
+   current_timeline = (current_timeline+steps+timelines.threads())%timelines.threads();
+   current_stream_call = -1;
+   visible_calls_valid = false;
+   showTimelineStream(NULL);
+
+   ostringstream label;
+   label << "thread " << timelines.tid(current_timeline) << ": "
+         << timelines.calls(current_timeline) << " calls";
+   updateText->setText(label.str());
+}
+
+//a grid with a column in each cell representing each stream,
+//tile by tile (lod.h), so the streams of a tile are neighbors in the table
+void placeGrid(int first) {
+   UINT64 n = max((UINT64)stream_table.size(),layout_size);
+   int dim = GridLod::side(n);
+   double t = now();
+   for(int i=first;i<stream_table.size();++i) {
+      UINT32 row, col;
+      GridLod::place(i,n,&row,&col);
+      for(int j=0;j<stream_table[i]->sl;++j) {
+         cubes->moveTo(stream_table[i]->first_instance+j,osg::Vec3((int)row-dim/2,-j,(int)col-dim/2),t,1.0);
       }
-   } while(stream_table[stream_call_order[current_stream_call]]->hidden==true);
+   }
+}
 
-   int current_stream = stream_call_order[current_stream_call];
+//Force layout (5): a worker thread runs ForceLayout (force_layout.h) on all
+//cores over the streams, pulled together by their transitions, and
+//publishes the positions after every step. The render thread moves the
+//cubes to the latest ones every FORCE_APPLY_SECONDS, animated over that
+//time, so the layout unfolds while the viewer stays responsive.
+#define FORCE_APPLY_SECONDS 0.25
+
+static pthread_mutex_t force_lock = PTHREAD_MUTEX_INITIALIZER; //guards force_positions, force_generation and force_stop
+static vector<float> force_positions; //x,z of each stream_table entry, as last published
+static UINT64 force_generation = 0; //publishes so far
+static UINT64 force_applied = 0; //publish the cubes were last moved to
+static double force_applied_time = 0;
+static bool force_stop = false; //asks the worker to return
+static bool force_running = false; //a worker was started and not joined yet
+static pthread_t force_thread;
+#define FORCE_FRAME_STEPS 1 //steps a frame when no worker could be started
+static ForceLayout* force_inline = NULL; //the layout stepped by updateForceLayout instead of a worker
+
+void* forceLayoutThread(void* arg) {
+   ForceLayout* layout = static_cast<ForceLayout*>(arg);
+   unsigned cores = parallel_cores();
+   bool more = true;
+   while(more) {
+      more = layout->step(cores);
+      pthread_mutex_lock(&force_lock);
+      force_positions = layout->positions();
+      force_generation++;
+      if(force_stop) more = false;
+      pthread_mutex_unlock(&force_lock);
+   }
+   delete layout;
+   return NULL;
+}
 
-   updateText->setText(stream_table[current_stream]->transforms[0]->getName());
+void stopForceLayout() {
+   delete force_inline;
+   force_inline = NULL;
+   if(!force_running) return;
+   pthread_mutex_lock(&force_lock);
+   force_stop = true;
+   pthread_mutex_unlock(&force_lock);
+   pthread_join(force_thread,NULL);
+   force_running = false;
+}
 
-   for(int i=0;i<stream_table[current_stream]->sl;++i) {
-      setColor(stream_table[current_stream]->transforms[i],0.0,0.0,1.0);
+//lay out the streams loaded so far by their transitions, from where they are now
+void startForceLayout() {
+   stopForceLayout();
+   double t = now();
+   vector<float> xy(2*stream_table.size());
+   for(size_t i=0;i<stream_table.size();++i) {
+      const stream_table_entry* e = stream_table[i];
+      osg::Vec3 p = e->sl ? cubes->position(e->first_instance,t) : osg::Vec3(0,0,0);
+      xy[2*i] = p.x();
+      xy[2*i+1] = p.z();
+   }
+   //every transition between two streams, both ways, weighted by log count
+   vector<force_edge> edges;
+   UINT64 most = 1;
+   for(size_t i=0;i<stream_table.size();++i) {
+      const stream_table_entry* e = stream_table[i];
+      for(UINT32 k=0;k<e->nstream;++k) {
+         const stream_table_entry* to = streamById(e->next_stream[k].id);
+         if(to == NULL || to == e) continue;
+         force_edge edge = { e->index, to->index, (float)e->next_stream[k].count };
+         edges.push_back(edge);
+         most = max(most,e->next_stream[k].count);
+      }
    }
+   for(size_t k=0;k<edges.size();++k) edges[k].weight = log(1.0+edges[k].weight)/log(1.0+most);
+
+   ForceLayout* layout = new ForceLayout();
+   layout->init(xy,edges);
+   force_stop = false;
+   force_positions = xy;
+   force_generation = 0;
+   force_applied = 0;
+   force_applied_time = 0;
+   force_running = pthread_create(&force_thread,NULL,forceLayoutThread,layout) == 0;
+   //without a worker, the render thread steps it a little every frame
+   if(!force_running) force_inline = layout;
 }
 
-void placeStreams(int scheme) {
-   //a grid with a column in each cell representing each stream
-   if(scheme == GRID_LAYOUT) {
-      int dim = ceil(sqrt(stream_table.size()));
-      int row=0;
-      int col=0;
-      for(int i=0;i<stream_table.size();++i) {
-         for(int j=0;j<stream_table[i]->sl;++j) {
-            osg::AnimationPath* ap = stream_table[i]->animationPaths[j];
-            ap->setLoopMode( osg::AnimationPath::NO_LOOPING );
-            osg::Vec3 curPos = stream_table[i]->transforms[j]->getPosition();
-            ap->clear();
-            ap->insert(0.0f,osg::AnimationPath::ControlPoint(curPos));
-            ap->insert(1.0f,osg::AnimationPath::ControlPoint(osg::Vec3(row-dim/2,-j,col-dim/2)));
-            stream_table[i]->transforms[j]->setUpdateCallback(new osg::AnimationPathCallback(ap));
-         }
-	 if(++row>=dim) {
-	    row=0;
-	    col++;
-	 }
+//move the cubes to the positions published last; render thread, once a frame
+void updateForceLayout(double t) {
+   if(currentPlacement != FORCE_LAYOUT) return;
+   if(force_inline) {
+      for(int k=0;k<FORCE_FRAME_STEPS && force_inline->step(1);++k);
+      force_positions = force_inline->positions();
+      force_generation++;
+      if(force_inline->converged()) {
+         delete force_inline;
+         force_inline = NULL;
+      }
+   }
+   if(t < force_applied_time+FORCE_APPLY_SECONDS) return;
+   vector<float> xy;
+   pthread_mutex_lock(&force_lock);
+   if(force_generation != force_applied) {
+      xy = force_positions;
+      force_applied = force_generation;
+   }
+   pthread_mutex_unlock(&force_lock);
+   if(xy.empty()) return;
+   force_applied_time = t;
+   for(size_t i=0;i<xy.size()/2 && i<stream_table.size();++i) {
+      const stream_table_entry* e = stream_table[i];
+      for(UINT32 j=0;j<e->sl;++j) {
+         cubes->moveTo(e->first_instance+j,osg::Vec3(xy[2*i],-(float)j,xy[2*i+1]),t,FORCE_APPLY_SECONDS);
       }
    }
+}
+
+//place stream_table[first] onwards; the others stay where they are
+void placeStreams(int scheme, int first) {
+   currentPlacement = scheme;
+   if(scheme != FORCE_LAYOUT) stopForceLayout();
+   if(scheme == GRID_LAYOUT) {
+      placeGrid(first);
+   }
+
+   //streams loaded while the force layout runs wait in their grid cells until 5 is pressed again
+   else if(scheme == FORCE_LAYOUT) {
+      if(first == 0) startForceLayout();
+      else placeGrid(first);
+   }
 
    //2d row layout
    else if(scheme == ROW_LAYOUT) {
-      int row=0;
+      int row=first;
       int col=0;
-      int dim = stream_table.size();
-      for(int i=0;i<stream_table.size();++i) {
+      int dim = max((UINT64)stream_table.size(),layout_size);
+      double t = now();
+      for(int i=first;i<stream_table.size();++i) {
 	 for(int j=0;j<stream_table[i]->sl;++j) {
-            osg::AnimationPath* ap = stream_table[i]->animationPaths[j];
-            ap->setLoopMode( osg::AnimationPath::NO_LOOPING );
-            osg::Vec3 curPos = stream_table[i]->transforms[j]->getPosition();
-            ap->clear();
-            ap->insert(0.0f,osg::AnimationPath::ControlPoint(osg::Vec3(curPos)));
-            ap->insert(1.0f,osg::AnimationPath::ControlPoint(osg::Vec3(row-dim/2,0,col++)));
-            stream_table[i]->transforms[j]->setUpdateCallback(new osg::AnimationPathCallback(ap));
+            cubes->moveTo(stream_table[i]->first_instance+j,osg::Vec3(row-dim/2,0,col++),t,1.0);
 	 }
          row++;
          col=0;
@@ -350,173 +738,900 @@ void placeStreams(int scheme) {
    }
 }
 
+//filter on the highlighted stream's image: hide it, or hide everything else
 void hideByImage(int scheme) {
-   if(highlighted.size()<1) return;
-   char* imgName = NULL;
-   for(int i=0;i<stream_table.size();++i) {
-      for(int j=0;j<stream_table[i]->sl;++j) {
-         osg::PositionAttitudeTransform *t= stream_table[i]->transforms[j];
-         if(highlighted[highlighted.size()-1]==t) {
-            imgName = stream_table[i]->img_name;
+   if(highlighted==NULL) return;
+   StreamFilter filter;
+   string error;
+   if(!filter.parse(string("img=\"")+highlighted->img_name+"\"",&error)) return;
+   filters.push(filter,scheme==HIDE_ALL_ELSE);
+   applyFilters();
+}
+
+filter_stream filterStream(const stream_table_entry* e) {
+   filter_stream s;
+   s.img = e->img;
+   s.rtn = e->rtn;
+   s.sl = e->sl;
+   s.lscount = e->lscount;
+   s.scount = e->scount;
+   return s;
+}
+
+void setStreamVisible(stream_table_entry* e, bool visible) {
+   e->hidden = !visible;
+   drawStream(e);
+}
+
+//true unless e is filtered out or its tile is collapsed
+bool streamDrawn(const stream_table_entry* e) {
+   return !e->hidden && lod.tile_expanded(GridLod::tile_of(e->index));
+}
+
+//draw e's cubes if streamDrawn says so
+void drawStream(stream_table_entry* e) {
+   if(draw_stream(cubes,e->first_instance,e->sl,&e->drawn,streamDrawn(e))) transitions_dirty = true;
+}
+
+//Transitions (next_stream) are drawn as lines from the last instruction of
+//a stream to the first of its successor, brighter the more often taken.
+//selectTransitions() picks them (transitions.h) when loading is done or
+//the limits change; the lines follow layout switches by themselves, and
+//filters and the LOD only change which are drawn (updateTransitions).
+void selectTransitions() {
+   transitions.clear();
+   transition_lines->clear();
+   for(size_t i=0;i<stream_table.size();++i) {
+      const stream_table_entry* e = stream_table[i];
+      select_transitions(e->id,e->next_stream,e->nstream,transition_min_count,transition_top,&transitions);
+   }
+   //drop those to streams not loaded, then shade by log count against the most taken
+   size_t kept = 0;
+   UINT64 most = 1;
+   for(size_t k=0;k<transitions.size();++k) {
+      if(streamById(transitions[k].to) == NULL) continue;
+      most = max(most,transitions[k].count);
+      transitions[kept++] = transitions[k];
+   }
+   transitions.resize(kept);
+   for(size_t k=0;k<transitions.size();++k) {
+      const stream_table_entry* from = streamById(transitions[k].from);
+      const stream_table_entry* to = streamById(transitions[k].to);
+      float weight = log(1.0+transitions[k].count)/log(1.0+most);
+      transition_lines->add(from->first_instance+from->sl-1,to->first_instance,osg::Vec4(0.3,0.8,1.0,0.15+0.85*weight));
+   }
+   transitions_dirty = true;
+
+   ostringstream label;
+   label << transitions.size() << " transitions taken at least " << transition_min_count << " times, ";
+   if(transition_top) label << "at most " << transition_top << " per stream";
+   else label << "all per stream";
+   updateText->setText(label.str());
+}
+
+//transitions between drawn streams, by line
+typedef struct TransitionShown {
+   bool operator()(UINT32 k) const {
+      return streamDrawn(streamById(transitions[k].from)) && streamDrawn(streamById(transitions[k].to));
+   }
+} TransitionShown;
+
+//redraw the lines if streams were drawn or hidden; once a frame
+void updateTransitions() {
+   if(!transitions_dirty) return;
+   transition_lines->show(TransitionShown());
+   transitions_dirty = false;
+}
+
+//draw the streams of these tiles, or not, as the LOD now says
+void drawTiles(const vector<UINT32>& tiles) {
+   for(size_t k=0;k<tiles.size();++k) {
+      UINT64 end = min((UINT64)(tiles[k]+1)*GridLod::TILE_STREAMS,(UINT64)stream_table.size());
+      for(UINT64 i=(UINT64)tiles[k]*GridLod::TILE_STREAMS;i<end;++i) drawStream(stream_table[i]);
+   }
+}
+
+//one box of 6 quads per tile and per region, as deep as GridLod::depth and
+//colored by log scount against the other boxes of its level; made once,
+//when loading is done, after which only the index list changes
+void makeAggregates() {
+   static const float corners[6][4][3] = {
+      {{0,0,0},{0,1,0},{0,1,1},{0,0,1}}, {{1,0,0},{1,0,1},{1,1,1},{1,1,0}},
+      {{0,0,0},{0,0,1},{1,0,1},{1,0,0}}, {{0,1,0},{1,1,0},{1,1,1},{0,1,1}},
+      {{0,0,0},{1,0,0},{1,1,0},{0,1,0}}, {{0,0,1},{0,1,1},{1,1,1},{1,0,1}}
+   };
+   static const float face_normals[6][3] = { {-1,0,0}, {1,0,0}, {0,-1,0}, {0,1,0}, {0,0,-1}, {0,0,1} };
+   osg::Vec3Array* vertices = new osg::Vec3Array;
+   osg::Vec3Array* normals = new osg::Vec3Array;
+   osg::Vec4Array* colors = new osg::Vec4Array;
+   float half = GridLod::side(layout_size)/2;
+   for(int level=0;level<2;++level) {
+      const vector<lod_aggregate>& v = level ? lod.regions : lod.tiles;
+      double max_log = 1;
+      for(size_t k=0;k<v.size();++k) max_log = max(max_log,log(1.0+v[k].scount));
+      for(size_t k=0;k<v.size();++k) {
+         const lod_aggregate& a = v[k];
+         osg::Vec3 lo(a.row-half,1-GridLod::depth(a),a.col-half);
+         osg::Vec3 size(a.size,GridLod::depth(a),a.size);
+         osg::Vec4 color = rgbInterp(0,max_log,log(1.0+a.scount));
+         for(int f=0;f<6;++f) {
+            for(int c=0;c<4;++c) {
+               vertices->push_back(lo+osg::Vec3(corners[f][c][0]*size.x(),corners[f][c][1]*size.y(),corners[f][c][2]*size.z()));
+               normals->push_back(osg::Vec3(face_normals[f][0],face_normals[f][1],face_normals[f][2]));
+               colors->push_back(color);
+            }
          }
       }
    }
-   for(int i=0;i<stream_table.size();++i) {
-      if(scheme==HIDE && strcmp(imgName,stream_table[i]->img_name)==0) {
-         stream_table[i]->hidden = true;
-         moveToInfinity(i);
-      }
-      else if(scheme==HIDE_ALL_ELSE && strcmp(imgName,stream_table[i]->img_name)!=0) {
-         stream_table[i]->hidden = true;
-         moveToInfinity(i);
+   aggregates->setVertexArray(vertices);
+   aggregates->setNormalArray(normals);
+   aggregates->setNormalBinding(osg::Geometry::BIND_PER_VERTEX);
+   aggregates->setColorArray(colors);
+   aggregates->setColorBinding(osg::Geometry::BIND_PER_VERTEX);
+   aggregates->addPrimitiveSet(new osg::DrawElementsUInt(GL_QUADS));
+}
+
+//draw the blocks of the tiles and regions the LOD shows
+void showAggregates() {
+   if(aggregates->getNumPrimitiveSets() == 0) return;
+   osg::DrawElementsUInt* shown = static_cast<osg::DrawElementsUInt*>(aggregates->getPrimitiveSet(0));
+   shown->clear();
+   for(int level=0;level<2;++level) {
+      const vector<lod_aggregate>& v = level ? lod.regions : lod.tiles;
+      GLuint first = level ? 24*lod.tiles.size() : 0;
+      for(size_t k=0;k<v.size();++k) {
+         if(!v[k].shown) continue;
+         for(GLuint c=0;c<24;++c) shown->push_back(first+24*k+c);
       }
    }
+   shown->dirty();
+   aggregates->dirtyBound();
 }
 
-void moveToInfinity(int stream_table_index)
-{
-   for(int j=0;j<stream_table[stream_table_index]->sl;++j) {
-      osg::AnimationPath* ap = stream_table[stream_table_index]->animationPaths[j];
-      ap->setLoopMode( osg::AnimationPath::NO_LOOPING );
-      osg::Vec3 curPos = stream_table[stream_table_index]->transforms[j]->getPosition();
-      ap->clear();
-      ap->insert(0.0f,osg::AnimationPath::ControlPoint(osg::Vec3(curPos)));
-      ap->insert(5.0f,osg::AnimationPath::ControlPoint(osg::Vec3(500,500,0)));
-      stream_table[stream_table_index]->transforms[j]->setUpdateCallback(new osg::AnimationPathCallback(ap));
+//sum up the tiles and regions once every stream is in; they are fixed from then on
+void buildLod() {
+   vector<lod_stream> streams(stream_table.size());
+   for(size_t i=0;i<stream_table.size();++i) {
+      lod_stream& s = streams[i];
+      s.sl = stream_table[i]->sl;
+      s.img = stream_table[i]->img;
+      s.rtn = stream_table[i]->rtn;
+      s.scount = stream_table[i]->scount;
+   }
+   lod.build(streams,layout_size);
+   makeAggregates();
+   lod_active = currentPlacement == GRID_LAYOUT;
+}
+
+//collapse the tiles and regions far from the eye and expand those near it
+void updateLod(const osg::Vec3& eye) {
+   if(!lod_active) return;
+   float half = GridLod::side(layout_size)/2;
+   vector<UINT32> changed;
+   bool blocks = lod.update(eye.x()+half,eye.y(),eye.z()+half,&changed);
+   drawTiles(changed);
+   if(blocks) showAggregates();
+}
+
+//draw every stream and no aggregate, for layouts other than the grid
+void expandAll() {
+   lod_active = false;
+   vector<UINT32> changed;
+   lod.expand_all(&changed);
+   drawTiles(changed);
+   showAggregates();
+}
+
+//evaluate the filters over every stream, on all cores, and show the result
+void applyFilters() {
+   filters.bind(name_by_id);
+   vector<filter_stream> streams(stream_table.size());
+   for(size_t i=0;i<stream_table.size();++i) streams[i] = filterStream(stream_table[i]);
+   vector<UINT64> visible;
+   filters.evaluate(streams,&visible,parallel_cores());
+   UINT64 shown = 0;
+   for(size_t i=0;i<stream_table.size();++i) {
+      bool v = (visible[i/64] >> (i%64)) & 1;
+      if(v == stream_table[i]->hidden) setStreamVisible(stream_table[i],v);
+      shown += v;
    }
+   ostringstream label;
+   label << shown << " of " << stream_table.size() << " streams shown";
+   if(!filters.empty()) label << ": " << filters.describe();
+   updateText->setText(label.str());
+   visible_calls_valid = false;
 }
 
-void colorStreams(int scheme) {
+//color e by the current scheme, with the scales colorStreams computed last
+void colorStream(stream_table_entry* e) {
    //green==memory read, red==memory write, white==no memory access
-   if(scheme == MEMORY_COLORING) {
-      currentColoring = MEMORY_COLORING;
-      for(int i=0;i<stream_table.size();++i) {
-         for(int j=0;j<stream_table[i]->sl;++j) {
-	    if(stream_table[i]->insvalues[j] == INS_NORMAL)
-	       setColor(stream_table[i]->transforms[j],1.0,1.0,1.0);
-	    else if(stream_table[i]->insvalues[j] == INS_READ)
-	       setColor(stream_table[i]->transforms[j],0.0,1.0,0.0);
-	    else if(stream_table[i]->insvalues[j] == INS_WRITE)
-	       setColor(stream_table[i]->transforms[j],1.0,0.0,0.0);
-         }
+   if(currentColoring == MEMORY_COLORING) {
+      for(int j=0;j<e->sl;++j) {
+         if(insval(e,j) == INS_NORMAL)
+            cubes->setColor(e->first_instance+j,1.0,1.0,1.0);
+         else if(insval(e,j) == INS_READ)
+            cubes->setColor(e->first_instance+j,0.0,1.0,0.0);
+         else if(insval(e,j) == INS_WRITE)
+            cubes->setColor(e->first_instance+j,1.0,0.0,0.0);
       }
    }
-   else if(scheme == EXECUTION_FREQ_COLORING) {
-      currentColoring = EXECUTION_FREQ_COLORING;
-      int min_size = stream_table[0]->scount;
-      int max_size = min_size;
+   else if(currentColoring == EXECUTION_FREQ_COLORING) {
+      osg::Vec4 color = rgbInterp(color_min_scount,color_max_scount,e->scount);
+      setStreamColor(e,color[0],color[1],color[2]);
+   }
+   //green==few cache lines/mostly within a line, red==many lines/far strides,
+   //grey==no memory record
+   else if(currentColoring == FOOTPRINT_COLORING || currentColoring == STRIDE_COLORING) {
+      osg::Vec4 color(0.5,0.5,0.5,1.0);
+      if(e->has_memory) {
+         if(currentColoring == FOOTPRINT_COLORING)
+            color = rgbInterp(0,log(color_max_lines),log((double)max(e->mem_lines,1u)));
+         else
+            color = rgbInterp(0,1,e->mem_far);
+      }
+      setStreamColor(e,color[0],color[1],color[2]);
+   }
+}
 
+//color stream_table[first] onwards, scaled over the whole table
+void colorStreams(int scheme, int first) {
+   currentColoring = scheme;
+   if(scheme == EXECUTION_FREQ_COLORING) {
+      if(stream_table.empty()) return;
+      color_min_scount = stream_table[0]->scount;
+      color_max_scount = color_min_scount;
       for(int i=1;i<stream_table.size();++i) {
-         if(stream_table[i]->scount > max_size) {
-            max_size = stream_table[i]->scount;
-         }
-         if(stream_table[i]->scount < min_size) {
-            min_size = stream_table[i]->scount;
-         }
+         color_max_scount = max(color_max_scount,stream_table[i]->scount);
+         color_min_scount = min(color_min_scount,stream_table[i]->scount);
       }
+      //counts keep growing while the target runs; the scale only moves when the hottest doubles
+      if(color_scale_rounded) {
+         UINT64 top = 1;
+         while(top < color_max_scount && top < ((UINT64)1 << 63)) top <<= 1;
+         color_max_scount = max(color_max_scount,top);
+      }
+   }
+   else if(scheme == FOOTPRINT_COLORING) {
+      color_max_lines = 1;
       for(int i=0;i<stream_table.size();++i) {
-         osg::Vec4 color = rgbInterp(min_size,max_size,stream_table[i]->scount);
-         for(int j=0;j<stream_table[i]->sl;++j) {
-            setColor(stream_table[i]->transforms[j],color[0],color[1],color[2]);
-         }
+         color_max_lines = max(color_max_lines,(double)stream_table[i]->mem_lines);
       }
    }
+   for(int i=first;i<stream_table.size();++i) {
+      colorStream(stream_table[i]);
+   }
+   //the stream stepped to stays blue, and the heat trail stays
+   for(size_t i=0;i<hot_streams.size();++i) paintStream(hot_streams[i]);
+   if(timeline_stream) paintStream(timeline_stream);
 }
 
-int main(int argc, char** argv)
-{
-   if(argc<2) {
-      printf("Usage: pinvis <input file>\n");
+//e as it shows now: blue if stepped to, its heat if called lately, else its scheme color
+void paintStream(stream_table_entry* e) {
+   if(e == timeline_stream) setStreamColor(e,0.0,0.0,1.0);
+   else if(e->heat_level > 0) setStreamColor(e,1.0,(float)e->heat_level/HEAT_LEVELS,0.0);
+   else colorStream(e);
+}
+
+//show e in blue, and the stream shown before as it was again
+void showTimelineStream(stream_table_entry* e) {
+   stream_table_entry* previous = timeline_stream;
+   timeline_stream = e;
+   if(previous && previous != e) paintStream(previous);
+   if(e) paintStream(e);
+}
+
+//read a memory file written by streamcount -memory into the stream table
+void loadMemory(const char* filename) {
+   ifstream memoryFile;
+   memoryFile.open(filename,ios::binary);
+   UINT32 header[5];
+   if(!memoryFile.read((char*)header,sizeof(header)) || header[0] != MEMORY_MAGIC) {
+      printf("%s is not a memory file\n",filename);
+      return;
+   }
+   UINT32 line_shift = header[3];
+   for(UINT32 i=0;i<header[4];++i) {
+      memory_stream_header h;
+      if(!memoryFile.read((char*)&h,sizeof(h))) break;
+      //the page and line histograms; only their sizes are shown for now
+      memoryFile.seekg(sizeof(UINT64)*2*((UINT64)h.npages+h.nlines),ios::cur);
+      stream_table_entry* e = streamById(h.id);
+      if(e == NULL) continue;
+
+      UINT64 strides = 0, far = 0;
+      for(UINT32 b=0;b<MEMORY_STRIDE_BUCKETS;++b) {
+         strides += h.strides[b];
+         //bucket b holds strides of at least 2^(b-1) bytes
+         if(b > line_shift) far += h.strides[b];
+      }
+      e->has_memory = true;
+      e->mem_lines = h.nlines;
+      e->mem_far = strides ? (double)far/strides : 0.0;
+   }
+}
+
+//the stream with this id, NULL if it has not been loaded
+stream_table_entry* streamById(UINT64 id) {
+   return id < stream_by_id.size() ? stream_by_id[id] : NULL;
+}
+
+//reset the state pinvis keeps for e beyond what the input holds
+void initStream(stream_table_entry* e) {
+   e->index = 0;
+   e->first_instance = 0;
+   e->hidden = false;
+   e->drawn = true;
+   e->heat = 0;
+   e->heat_level = 0;
+   e->has_memory = false;
+   e->mem_lines = 0;
+   e->mem_far = 0.0;
+}
+
+//give e a cube per instruction and append it to the stream table; render thread only
+void addStream(stream_table_entry* e) {
+   e->index = stream_table.size();
+   e->first_instance = cubes->add(e->sl);
+   instance_stream.resize(cubes->size(),stream_table.size());
+   if(!filters.empty()) {
+      filters.bind(name_by_id);
+      if(!filters.visible(filterStream(e))) setStreamVisible(e,false);
+   }
+   stream_table.push_back(e);
+   if(e->id >= stream_by_id.size()) stream_by_id.resize(e->id+1,NULL);
+   stream_by_id[e->id] = e;
+}
+
+//shown when the stream is picked or stepped to
+string streamLabel(const stream_table_entry* e) {
+   ostringstream name;
+   name << e->img_name << ":" << e->rtn_name << " " << e->sl;
+   return name.str();
+}
+
+//Progressive loading: a worker thread makes the entries, hottest streams
+//first, and queues them in batches; the render thread gives a bounded
+//number of them their cubes each frame
+//(consumeLoaded), so the viewer is usable while the rest comes in.
+#define LOAD_BATCH_STREAMS 1024 //streams handed over at a time
+#define LOAD_FRAME_STREAMS 16384 //streams added to the scene per frame at most
+
+static pthread_mutex_t load_lock = PTHREAD_MUTEX_INITIALIZER; //guards load_queue and load_done
+static deque<vector<stream_table_entry*>*> load_queue;
+static bool load_done = false; //the worker has queued every stream
+static bool loading = false; //streams are still being added to the scene
+static string load_label; //shown once loading is done
+
+static bool hotter(const pv_stream* a, const pv_stream* b) {
+   return a->scount > b->scount || (a->scount == b->scount && a < b);
+}
+
+//worker thread: make entries in decreasing scount order and queue them
+void* loadStreams(void* arg) {
+   const PvFile* pv = streamcount_file;
+   const pv_header& h = pv->header();
+   double count_scale = sampling_scale(h.sampling);
+
+   vector<const pv_stream*> order(h.nstreams);
+   for(UINT64 i=0;i<h.nstreams;++i) order[i] = &pv->stream(i);
+   sort(order.begin(),order.end(),hotter);
+
+   //one allocation for all entries; names, Insvals and successors stay in the mapping
+   stream_table_entry* entries = new stream_table_entry[h.nstreams];
+   vector<stream_table_entry*>* batch = new vector<stream_table_entry*>;
+   for(UINT64 i=0;i<h.nstreams;++i) {
+      const pv_stream& s = *order[i];
+      UINT32 id = order[i]-&pv->stream(0);
+      stream_table_entry* e = &entries[id];
+      e->id = id;
+      e->sl = s.sl;
+      e->insvalues = pv->insvals();
+      e->insval_first = s.insval_first;
+      e->lscount = s.lscount;
+      e->scount = (UINT64)(s.scount*count_scale+0.5);
+      e->img = s.img;
+      e->rtn = s.rtn;
+      e->img_name = pv->string(s.img);
+      e->rtn_name = pv->string(s.rtn);
+      uint64_t nstream;
+      e->next_stream = pv->edges(id,&nstream);
+      e->nstream = nstream;
+      initStream(e);
+      batch->push_back(e);
+      if(batch->size() == LOAD_BATCH_STREAMS || i+1 == h.nstreams) {
+         pthread_mutex_lock(&load_lock);
+         load_queue.push_back(batch);
+         pthread_mutex_unlock(&load_lock);
+         batch = new vector<stream_table_entry*>;
+      }
+   }
+   delete batch;
+   pthread_mutex_lock(&load_lock);
+   load_done = true;
+   pthread_mutex_unlock(&load_lock);
+   return NULL;
+}
+
+//render thread: add queued streams to the scene and show the progress;
+//true on the frame the last stream is added
+bool consumeLoaded() {
+   if(!loading) return false;
+   int first = stream_table.size();
+   bool done = false;
+   while(stream_table.size()-first < LOAD_FRAME_STREAMS) {
+      pthread_mutex_lock(&load_lock);
+      vector<stream_table_entry*>* batch = NULL;
+      if(!load_queue.empty()) {
+         batch = load_queue.front();
+         load_queue.pop_front();
+      }
+      done = load_done && load_queue.empty();
+      pthread_mutex_unlock(&load_lock);
+      if(batch == NULL) break;
+      for(size_t i=0;i<batch->size();++i) addStream((*batch)[i]);
+      delete batch;
+   }
+   if(stream_table.size() != first) {
+      placeStreams(currentPlacement,first);
+      colorStreams(currentColoring,first);
+   }
+   if(done) {
+      loading = false;
+      //scales such as the execution frequency range are final only now
+      colorStreams(currentColoring);
+      buildLod();
+      //calls to streams that were not loaded yet are shown now
+      visible_calls_valid = false;
+      selectTransitions();
+      updateText->setText(load_label);
+      return true;
+   }
+   ostringstream label;
+   label << "loading: " << stream_table.size() << " of " << layout_size << " streams";
+   updateText->setText(label.str());
+   return false;
+}
+
+//map a streamcount file and start loading its streams, in the background
+//unless pinvis --bench times the load
+void loadStreamcount(const char* filename, bool background = true) {
+   if(!PvFile::is_pv(filename)) {
+      cerr << filename << " is not a pv file; files from older versions of streamcount can be converted with pvconvert" << endl;
       exit(1);
    }
+   streamcount_file = PvFile::open(filename);
+   if(streamcount_file == NULL) {
+      cerr << "could not read " << filename << endl;
+      exit(1);
+   }
+   const pv_header& h = streamcount_file->header();
+   UINT32 mode = h.mode;
+   streamcount_sampling sampling = h.sampling;
+   //sampled counts are scaled up to estimates for the whole window
+   double count_scale = sampling_scale(sampling);
+
+   ostringstream label;
+   //count mode files hold basic blocks, without successors or a timeline
+   if(mode == STREAMCOUNT_MODE_COUNT) label << "basic block counts only";
+   if(count_scale != 1.0) {
+      if(!label.str().empty()) label << "; ";
+      label << "sampled " << sampling.sample_on << " of every " << sampling.sample_period
+            << " instructions: counts scaled by " << count_scale;
+   }
+   load_label = label.str();
+
+   layout_size = h.nstreams;
+   name_by_id.resize(streamcount_file->strings());
+   for(size_t i=0;i<name_by_id.size();++i) name_by_id[i] = streamcount_file->string(i);
+   stream_table.reserve(h.nstreams);
+   stream_by_id.assign(h.nstreams,NULL);
+   loading = true;
+   pthread_t loader;
+   if(!background || pthread_create(&loader,NULL,loadStreams,NULL) != 0) {
+      loadStreams(NULL);
+   }
+   else {
+      pthread_detach(loader);
+   }
+}
 
-   char* filename = argv[1];
-   char* timelineFilename;
+//index a timeline file; its chunks are decoded as they are viewed
+void loadTimeline(const char* timelineFilename) {
+   if(!timelines.open(timelineFilename)) {
+      cerr << "could not read " << timelineFilename << endl;
+   }
+}
 
-   if(argc>2) {
-      timelineFilename = argv[2];
+//pinvis --live: streamcount -live ring, attached once the pintool has created it
+static ShmRing* live_ring = NULL;
+static bool live_ended = false;
+#define LIVE_FRAME_BYTES (1u<<20) //ring bytes applied per frame at most, so frames stay short
+#define LIVE_LAYOUT_STREAMS (1u<<16) //streams the live layout first makes room for; grows 4x when full
+
+//id of a name published by streamcount -live; each name is kept once
+UINT32 liveName(const char* p, UINT32 size) {
+   string name(p,strnlen(p,size));
+   map<string,UINT32>::iterator it = live_names.find(name);
+   if(it != live_names.end()) return it->second;
+   char* copy = new char[name.size()+1];
+   memcpy(copy,name.c_str(),name.size()+1);
+   UINT32 id = name_by_id.size();
+   name_by_id.push_back(copy);
+   live_names[name] = id;
+   return id;
+}
+
+//apply what streamcount -live published since the last frame: add new
+//streams, update counts and extend the timelines
+void consumeLive(const char* path) {
+   if(live_ring == NULL) {
+      live_ring = ShmRing::attach(path);
+      if(live_ring == NULL) return;
+   }
+   size_t old_streams = stream_table.size();
+   vector<UINT32> counted; //stream_table indices whose counts changed
+   bool ended = live_ended;
+   UINT64 consumed = 0;
+   UINT32 type, size;
+   const void* payload;
+   while(consumed < LIVE_FRAME_BYTES && live_ring->peek(&type,&payload,&size)) {
+      const char* p = static_cast<const char*>(payload);
+      if(type == LIVE_STREAM) {
+         live_stream h;
+         memcpy(&h,p,sizeof(h));
+         p += sizeof(h);
+         //streams come in id order and are never dropped
+         if(h.id == stream_table.size()) {
+            stream_table_entry* e = new stream_table_entry;
+            e->id = h.id;
+            e->sl = h.sl;
+            e->lscount = h.lscount;
+            e->scount = 0;
+            e->nstream = 0;
+            e->next_stream = NULL;
+            uint8_t* insvalues = new uint8_t[(e->sl+3)/4]();
+            for(UINT32 j=0;j<e->sl;++j) {
+               int v;
+               memcpy(&v,p+sizeof(int)*j,sizeof(int));
+               insvalues[j>>2] |= (v&3) << ((j&3)*2);
+            }
+            e->insvalues = insvalues;
+            e->insval_first = 0;
+            p += sizeof(int)*e->sl;
+            e->img = liveName(p,h.img_size);
+            e->img_name = name_by_id[e->img];
+            p += h.img_size;
+            e->rtn = liveName(p,h.rtn_size);
+            e->rtn_name = name_by_id[e->rtn];
+            initStream(e);
+            addStream(e);
+         }
+      }
+      else if(type == LIVE_COUNTS) {
+         const live_count* counts = reinterpret_cast<const live_count*>(p);
+         for(UINT32 i=0;i<size/sizeof(live_count);++i) {
+            if(counts[i].id >= stream_table.size()) continue;
+            stream_table[counts[i].id]->scount += counts[i].delta;
+            counted.push_back(counts[i].id);
+         }
+      }
+      else if(type == LIVE_TIMELINE) {
+         timeline_chunk_header header;
+         memcpy(&header,p,sizeof(header));
+         const UINT32* calls = reinterpret_cast<const UINT32*>(p+sizeof(header));
+         vector<UINT32> known;
+         for(UINT32 i=0;i<header.count;++i) {
+            if(calls[i] >= stream_table.size()) continue;
+            known.push_back(calls[i]);
+            stream_table[calls[i]]->scount++;
+         }
+         if(!known.empty()) timelines.append(header.tid,&known[0],known.size());
+         counted.insert(counted.end(),known.begin(),known.end());
+      }
+      else if(type == LIVE_END) {
+         live_ended = true;
+      }
+      consumed += sizeof(shm_ring_message)+size;
+      live_ring->pop();
+   }
+
+   bool added = stream_table.size() != old_streams;
+   //placed streams stay put until the layout outgrows its room
+   if(stream_table.size() > layout_size) {
+      if(layout_size == 0) layout_size = LIVE_LAYOUT_STREAMS;
+      while(stream_table.size() > layout_size) layout_size *= 4;
+      placeStreams(currentPlacement);
+   }
+   else if(added) placeStreams(currentPlacement,old_streams);
+
+   //only new streams and those counted are colored, unless a count left the
+   //scale, whose top colorStreams rounds up to a power of two
+   sort(counted.begin(),counted.end());
+   counted.erase(unique(counted.begin(),counted.end()),counted.end());
+   bool rescale = false;
+   if(currentColoring == EXECUTION_FREQ_COLORING) {
+      UINT64 most = color_max_scount, least = old_streams ? color_min_scount : ~(UINT64)0;
+      for(size_t i=0;i<counted.size();++i) most = max(most,stream_table[counted[i]]->scount);
+      for(size_t i=old_streams;i<stream_table.size();++i) {
+         most = max(most,stream_table[i]->scount);
+         least = min(least,stream_table[i]->scount);
+      }
+      rescale = most > color_max_scount || (added && least < color_min_scount);
    }
+   if(rescale) colorStreams(currentColoring);
    else {
-      timelineFilename = NULL;
+      if(added) colorStreams(currentColoring,old_streams);
+      if(currentColoring == EXECUTION_FREQ_COLORING) {
+         for(size_t i=0;i<counted.size();++i) {
+            if(counted[i] < old_streams) paintStream(stream_table[counted[i]]);
+         }
+      }
    }
+   if(added || live_ended != ended) {
+      ostringstream label;
+      label << "live: " << stream_table.size() << " streams, "
+            << live_ring->dropped() << " updates dropped" << (live_ended ? ", target exited" : "");
+      updateText->setText(label.str());
+   }
+}
 
-   osgViewer::Viewer viewer;
+//the cubes, aggregate blocks, transition lines and HUD, empty until streams are added
+osg::Group* createScene() {
    osg::Group* root = new osg::Group();
-   osg::Geode* cubeGeode = new osg::Geode();
 
-   //Associate the cube geometry with the cube geode 
-   //   Add the cube geode to the root node of the scene graph.
+   //every instruction is an instance of one cube geometry
+   cubes = new InstancedCubes();
+   root->addChild(cubes->node());
+
+   //far tiles and regions of the grid are drawn as one block each (lod.h)
+   osg::Geode* aggregateGeode = new osg::Geode();
+   aggregates->setUseDisplayList(false);
+   aggregates->setUseVertexBufferObjects(true);
+   aggregateGeode->addDrawable(aggregates.get());
+   osg::Material* material = new osg::Material();
+   material->setColorMode(osg::Material::AMBIENT_AND_DIFFUSE);
+   aggregateGeode->getOrCreateStateSet()->setAttributeAndModes(material);
+   root->addChild(aggregateGeode);
 
-   cubeGeode->addDrawable(new osg::ShapeDrawable(new osg::Box(osg::Vec3(0.5,0.5,0.5),1.0,1.0,1.0))); 
+   transition_lines = new InstanceLines(cubes);
+   root->addChild(transition_lines->node());
 
    root->addChild(createHUD(updateText.get()));
-   PickHandler *pickHandler = new PickHandler(updateText.get());
-   viewer.addEventHandler(pickHandler);
-   viewer.addEventHandler(new KeyboardEventHandler());
+   return root;
+}
 
-   ifstream inFile;
-   inFile.open(filename,ofstream::binary);
-
-   UINT32 total_streams, dim;
-   int img_size=0,rtn_size=0;
-   inFile.read((char*)&total_streams,sizeof(UINT32));
-
-   for(int i=0;i<total_streams;++i) {
-      stream_table_entry* e = new stream_table_entry;
-      e->hidden = false;
-      inFile.read((char*)(&(e->sl)),sizeof(UINT32));
-      e->insvalues = new int[e->sl];
-      inFile.read((char*)(e->insvalues),sizeof(int)*e->sl);
-      inFile.read((char*)(&(e->lscount)),sizeof(UINT32));
-      inFile.read((char*)(&(e->scount)),sizeof(UINT32));
-      inFile.read((char*)(&(img_size)),sizeof(UINT32));
-      e->img_name = new char[img_size];
-      inFile.read(e->img_name,img_size);
-      inFile.read((char*)(&(rtn_size)),sizeof(UINT32));
-      e->rtn_name = new char[rtn_size];
-      inFile.read(e->rtn_name,rtn_size);
-      int next_stream_count;
-      inFile.read((char*)&next_stream_count,sizeof(int));
-      for(int j=0;j<next_stream_count;++j) {
-         int stream_index, times_executed;
-         inFile.read((char*)&stream_index,sizeof(UINT32));
-         inFile.read((char*)&times_executed,sizeof(UINT32));
-         e->next_stream.insert(pair<UINT32,UINT32>(stream_index,times_executed));
-      }
-      e->transforms = new osg::PositionAttitudeTransform*[e->sl];
-      e->animationPaths = new osg::AnimationPath*[e->sl];
+//camera manipulators (8 and 9), starting above the layout looking down on it
+void setHome(osgViewer::Viewer& viewer) {
+   osgGA::KeySwitchMatrixManipulator* keyswitchManipulator = new osgGA::KeySwitchMatrixManipulator;
+   keyswitchManipulator->addMatrixManipulator('8', "Trackball", new osgGA::TrackballManipulator());
+   keyswitchManipulator->addMatrixManipulator('9', "UFO", new osgGA::UFOManipulator());
 
-      for(int j=0;j<e->sl;++j) {
-         // Declare and initialize transform nodes.
-         e->transforms[j] = new osg::PositionAttitudeTransform();
-         e->transforms[j]->setPosition(osg::Vec3(0,0,0));
-         e->animationPaths[j] = new osg::AnimationPath();
+   viewer.setCameraManipulator(keyswitchManipulator);
+
+   osg::Vec3 lookFrom, lookAt, up;
+   lookFrom = osg::Vec3(0,min(-sqrt(max((UINT64)stream_table.size(),layout_size))*3,-25.0),0);
+   lookAt = osg::Vec3(0,0,1);
+   up = osg::Vec3(0,0,1);
 
-         // Use the 'addChild' method of the osg::Group class to
-         // add the transform as a child of the root node and the
-         // cube node as a child of the transform.
+   viewer.getCameraManipulator()->setHomePosition(lookFrom, lookAt, up, false);
+   viewer.home();
+}
 
-         root->addChild(e->transforms[j]);
-         e->transforms[j]->addChild(cubeGeode);
-         ostringstream name;
-         name << e->img_name << ":" << e->rtn_name << " " << e->sl;
-         e->transforms[j]->setName(name.str());
+//pinvis --bench: load a capture, draw it offscreen and print what each step costs
+#define BENCH_WIDTH 1024
+#define BENCH_HEIGHT 768
+#define BENCH_FRAMES 100 //frames timed once the streams are at rest
+#define BENCH_PICKS 1000 //rays cast through random points of the window
+
+//waits for the GPU at the end of each frame, so frame times include the drawing
+struct FinishDraw : public osg::Camera::DrawCallback {
+   virtual void operator()(osg::RenderInfo&) const {
+      glFinish();
+      if(renderer.empty()) {
+         const GLubyte* name = glGetString(GL_RENDERER);
+         if(name) renderer = (const char*)name;
       }
-      stream_table.push_back(e);
    }
+   mutable string renderer; //of the context drawn in, read on the first frame
+};
+
+static string jsonString(const string& s) {
+   string out = "\"";
+   for(size_t i=0;i<s.size();++i) {
+      if(s[i] == '"' || s[i] == '\\') out += '\\';
+      if((unsigned char)s[i] >= 0x20) out += s[i];
+   }
+   return out+"\"";
+}
+
+//resident memory now and at most so far, in MB
+static double residentMb() {
+   long pages = 0, resident = 0;
+   FILE* f = fopen("/proc/self/statm","r");
+   if(f) {
+      if(fscanf(f,"%ld %ld",&pages,&resident) != 2) resident = 0;
+      fclose(f);
+   }
+   return resident*(double)sysconf(_SC_PAGESIZE)/(1<<20);
+}
+
+static double peakResidentMb() {
+   struct rusage usage;
+   getrusage(RUSAGE_SELF,&usage);
+   return usage.ru_maxrss/1024.0; //kB on Linux
+}
+
+//one frame as the main loop draws it, in ms
+static double benchFrame(osgViewer::Viewer& viewer) {
+   double t = now();
+   updateLod(viewer.getCamera()->getInverseViewMatrix().getTrans());
+   updateTransitions();
+   cubes->update(now());
+   viewer.frame();
+   return (now()-t)*1000;
+}
+
+//print the costs for filename as one JSON line; needs an X server for the
+//pbuffer (Xvfb with Mesa llvmpipe does without a GPU)
+int bench(const char* filename) {
+   osg::ref_ptr<osg::GraphicsContext::Traits> traits = new osg::GraphicsContext::Traits;
+   traits->readDISPLAY();
+   traits->x = 0;
+   traits->y = 0;
+   traits->width = BENCH_WIDTH;
+   traits->height = BENCH_HEIGHT;
+   traits->pbuffer = true;
+   traits->doubleBuffer = false;
+   osg::ref_ptr<osg::GraphicsContext> gc = osg::GraphicsContext::createGraphicsContext(traits.get());
+   if(!gc.valid()) {
+      cerr << "pinvis --bench: could not create a pbuffer; without a display, run it under xvfb-run" << endl;
+      return 1;
+   }
+   osgViewer::Viewer viewer;
+   viewer.setThreadingModel(osgViewer::Viewer::SingleThreaded);
+   osg::Camera* camera = viewer.getCamera();
+   camera->setGraphicsContext(gc.get());
+   camera->setViewport(new osg::Viewport(0,0,BENCH_WIDTH,BENCH_HEIGHT));
+   camera->setProjectionMatrixAsPerspective(30.0,(double)BENCH_WIDTH/BENCH_HEIGHT,1.0,10000.0);
+   camera->setDrawBuffer(GL_FRONT);
+   camera->setReadBuffer(GL_FRONT);
+   osg::ref_ptr<FinishDraw> finish = new FinishDraw;
+   camera->setFinalDrawCallback(finish.get());
+   viewer.setSceneData(createScene());
+
+   //parse: map the file and make the entries; build: add them to the scene
+   double t = now();
+   loadStreamcount(filename,false);
+   double parse_ms = (now()-t)*1000;
+   t = now();
+   placeStreams(GRID_LAYOUT);
+   colorStreams(MEMORY_COLORING);
+   while(!consumeLoaded());
+   double build_ms = (now()-t)*1000;
 
-   if(timelineFilename) {
-      ifstream timelineFile;
-      timelineFile.open(timelineFilename,ios::binary);
+   viewer.realize();
+   setHome(viewer);
+   double first_frame_ms = benchFrame(viewer);
+   double resident_mb = residentMb();
+   while(cubes->moving(now())) benchFrame(viewer);
+   vector<double> frames;
+   for(int i=0;i<BENCH_FRAMES;++i) frames.push_back(benchFrame(viewer));
+   double frame_ms = 0;
+   for(size_t i=0;i<frames.size();++i) frame_ms += frames[i];
+   frame_ms /= frames.size();
+   sort(frames.begin(),frames.end());
+
+   //the first pick at rest builds the grid over the instances
+   t = now();
+   pickLabel(camera,0,0);
+   double pick_first_ms = (now()-t)*1000;
+   srand(1);
+   int hits = 0;
+   t = now();
+   for(int i=0;i<BENCH_PICKS;++i) {
+      float x = 2.0f*rand()/RAND_MAX-1, y = 2.0f*rand()/RAND_MAX-1;
+      if(!pickLabel(camera,x,y).empty()) hits++;
+   }
+   double pick_us = (now()-t)*1e6/BENCH_PICKS;
+
+   //switches: the CPU work and the frame that uploads it
+   t = now();
+   placeStreams(ROW_LAYOUT);
+   benchFrame(viewer);
+   double layout_ms = (now()-t)*1000;
+   t = now();
+   colorStreams(EXECUTION_FREQ_COLORING);
+   benchFrame(viewer);
+   double recolor_ms = (now()-t)*1000;
+
+   cout << "{\"capture\": " << jsonString(filename) << ", \"renderer\": " << jsonString(finish->renderer)
+        << ", \"streams\": " << stream_table.size() << ", \"instructions\": " << cubes->size()
+        << ", \"parse_ms\": " << parse_ms << ", \"build_ms\": " << build_ms
+        << ", \"first_frame_ms\": " << first_frame_ms << ", \"resident_mb\": " << resident_mb
+        << ", \"frame_ms\": " << frame_ms << ", \"frame_p95_ms\": " << frames[frames.size()*95/100]
+        << ", \"pick_first_ms\": " << pick_first_ms << ", \"pick_us\": " << pick_us
+        << ", \"pick_hits\": " << hits << ", \"layout_ms\": " << layout_ms << ", \"recolor_ms\": " << recolor_ms
+        << ", \"peak_resident_mb\": " << peakResidentMb() << "}" << endl;
+   return 0;
+}
+
+int main(int argc, char** argv)
+{
+   //--filter and --hide take a query (filter.h), --rate the playback speed and
+   //--min-transitions and --top-transitions the transitions drawn, and --bench
+   //prints the costs of loading and drawing instead of opening a window; they may come anywhere
+   int nargs = 1;
+   bool benchmark = false;
+   for(int i=1;i<argc;++i) {
+      bool keep = strcmp(argv[i],"--filter")==0;
+      if(strcmp(argv[i],"--rate")==0 && i+1<argc) {
+         play_rate = max(1.0,atof(argv[++i]));
+      }
+      else if(strcmp(argv[i],"--min-transitions")==0 && i+1<argc) {
+         transition_min_count = max(1ll,atoll(argv[++i]));
+      }
+      else if(strcmp(argv[i],"--top-transitions")==0 && i+1<argc) {
+         transition_top = atoi(argv[++i]);
+      }
+      else if(strcmp(argv[i],"--bench")==0) {
+         benchmark = true;
+      }
+      else if((keep || strcmp(argv[i],"--hide")==0) && i+1<argc) {
+         StreamFilter filter;
+         string error;
+         if(!filter.parse(argv[++i],&error)) {
+            cerr << "pinvis: " << argv[i] << ": " << error << endl;
+            exit(1);
+         }
+         filters.push(filter,keep);
+      }
+      else argv[nargs++] = argv[i];
+   }
+   argc = nargs;
 
-      int total_calls;
-      timelineFile.read((char*)&total_calls,sizeof(total_calls));
-      int call;
-      for(int i=0;i<total_calls;++i) {
-         timelineFile.read((char*)&call,sizeof(UINT32));
-         stream_call_order.push_back(call);
+   if(argc<2 || (strcmp(argv[1],"--live")==0 && argc<3)) {
+      printf("Usage: pinvis [--filter query] [--hide query] [--rate calls/s] [--min-transitions n] [--top-transitions k]\n");
+      printf("              <input file> [timeline file] [memory file]\n");
+      printf("       pinvis [--filter query] [--hide query] [--rate calls/s] --live <streamcount -live ring>\n");
+      printf("       pinvis [--filter query] [--hide query] --bench <input file>\n");
+      exit(1);
+   }
+   if(benchmark) {
+      if(strcmp(argv[1],"--live")==0) {
+         cerr << "pinvis: --bench needs an input file" << endl;
+         exit(1);
       }
+      return bench(argv[1]);
+   }
+
+   char* filename = argv[1];
+   char* timelineFilename;
+   char* liveFilename = NULL;
+
+   if(strcmp(argv[1],"--live")==0) {
+      liveFilename = argv[2];
+      color_scale_rounded = true;
+      filename = NULL;
+      timelineFilename = NULL;
+   }
+   else if(argc>2) {
+      timelineFilename = argv[2];
+   }
+   else {
+      timelineFilename = NULL;
    }
+   char* memoryFilename = filename && argc>3 ? argv[3] : NULL;
+
+   osgViewer::Viewer viewer;
+   //the cube textures are written between frames and uploaded while drawing
+   viewer.setThreadingModel(osgViewer::Viewer::SingleThreaded);
+   osg::Group* root = createScene();
+   viewer.addEventHandler(new PickHandler(updateText.get()));
+   viewer.addEventHandler(new KeyboardEventHandler());
+
+   //streams are added while the viewer runs; the memory file is applied once they are in
+   if(filename) loadStreamcount(filename);
+   if(timelineFilename) loadTimeline(timelineFilename);
 
    placeStreams(GRID_LAYOUT);
    colorStreams(MEMORY_COLORING);
@@ -526,24 +1641,23 @@ int main(int argc, char** argv)
    viewer.setSceneData( root );
    //viewer.run();
         
-   osgGA::KeySwitchMatrixManipulator* keyswitchManipulator = new osgGA::KeySwitchMatrixManipulator;
-   keyswitchManipulator->addMatrixManipulator('8', "Trackball", new osgGA::TrackballManipulator());
-   keyswitchManipulator->addMatrixManipulator('9', "UFO", new osgGA::UFOManipulator());
-
-   viewer.setCameraManipulator(keyswitchManipulator);
    viewer.setUpViewInWindow(0,0,1024,768);
    viewer.realize();
+   setHome(viewer);
 
-   osg::Vec3 lookFrom, lookAt, up;
-   lookFrom = osg::Vec3(0,min(-sqrt(stream_table.size())*3,-25.0),0);
-   lookAt = osg::Vec3(0,0,1);
-   up = osg::Vec3(0,0,1);
-
-   viewer.getCameraManipulator()->setHomePosition(lookFrom, lookAt, up, false);
-   viewer.home();
-
+   play_time = now();
    while( !viewer.done() )
    {
+      if(liveFilename) consumeLive(liveFilename);
+      if(consumeLoaded() && memoryFilename) {
+         loadMemory(memoryFilename);
+         if(currentColoring == FOOTPRINT_COLORING || currentColoring == STRIDE_COLORING) colorStreams(currentColoring);
+      }
+      updateLod(viewer.getCamera()->getInverseViewMatrix().getTrans());
+      playTimeline(now());
+      updateForceLayout(now());
+      updateTransitions();
+      cubes->update(now());
       viewer.frame();
    } 
 
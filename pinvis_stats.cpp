@@ -0,0 +1,353 @@
+//Headless summary of a capture, for servers without a display: top streams
+//by execution count, top routines and images by instructions executed, the
+//memory reference ratio and the hottest transitions between streams. The
+//stream table is mapped (pvformat.h) and reduced in parallel slices, one
+//per core; a timeline adds the calls per thread from its chunk index.
+//
+//usage: pinvis-stats [-f text|csv|json] [-n top] [-j threads] <streamcount.bin> [timeline.bin]
+
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <functional>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <tr1/unordered_map>
+
+#include "pvformat.h"
+#include "timeline_reader.h"
+#include "parallel.h"
+
+using namespace std;
+
+enum OutputFormat { TEXT_OUTPUT, CSV_OUTPUT, JSON_OUTPUT };
+
+//one entry of a top-N list: a count and what it belongs to
+typedef struct {
+   uint64_t count;
+   uint32_t a; //stream, image or routine
+   uint32_t b; //transition target or routine image
+} ranked;
+
+static bool count_greater(const ranked& x, const ranked& y) { return x.count > y.count; }
+
+//keep the top n entries of list as a min-heap
+static void offer(vector<ranked>* list, uint32_t n, uint64_t count, uint32_t a, uint32_t b)
+{
+   if(n == 0) return;
+   if(list->size() == n && count <= list->front().count) return;
+   ranked r = { count, a, b };
+   if(list->size() == n) {
+      pop_heap(list->begin(),list->end(),count_greater);
+      list->back() = r;
+   }
+   else {
+      list->push_back(r);
+   }
+   push_heap(list->begin(),list->end(),count_greater);
+}
+
+static uint64_t routine_key(uint32_t img, uint32_t rtn) { return ((uint64_t)img << 32) | rtn; }
+
+//aggregates of one slice of the stream table
+class StatsTask
+{
+public:
+   StatsTask() : pv(NULL), top(0), nstrings(0), scale(1.0), executions(0), instructions(0), memrefs(0),
+                 edges(0), transition_count(0) {}
+
+   void run(uint64_t begin, uint64_t end)
+   {
+      image_instructions.assign(nstrings,0);
+      for(uint64_t i=begin;i<end;++i) {
+         const pv_stream& s = pv->stream(i);
+         uint64_t scount = (uint64_t)(s.scount*scale+0.5);
+         executions += scount;
+         instructions += scount*s.sl;
+         memrefs += scount*s.lscount;
+         image_instructions[s.img] += scount*s.sl;
+         routine_instructions[routine_key(s.img,s.rtn)] += scount*s.sl;
+         offer(&streams,top,scount,i,0);
+         uint64_t n;
+         const pv_edge* e = pv->edges(i,&n);
+         edges += n;
+         for(uint64_t j=0;j<n;++j) {
+            uint64_t count = (uint64_t)(e[j].count*scale+0.5);
+            transition_count += count;
+            offer(&transitions,top,count,i,e[j].id);
+         }
+      }
+   }
+
+   const PvFile* pv;
+   uint32_t top;
+   uint32_t nstrings;
+   double scale;
+   uint64_t executions;
+   uint64_t instructions;
+   uint64_t memrefs;
+   uint64_t edges;
+   uint64_t transition_count;
+   vector<uint64_t> image_instructions; //indexed by string id
+   tr1::unordered_map<uint64_t,uint64_t> routine_instructions; //routine_key -> instructions
+   vector<ranked> streams; //top streams by scount
+   vector<ranked> transitions; //top <from,to> by count
+};
+
+static string csv_field(const string& s)
+{
+   if(s.find_first_of(",\"\n") == string::npos) return s;
+   string out = "\"";
+   for(size_t i=0;i<s.size();++i) {
+      if(s[i] == '"') out += '"';
+      out += s[i];
+   }
+   return out+"\"";
+}
+
+static string json_string(const string& s)
+{
+   string out = "\"";
+   for(size_t i=0;i<s.size();++i) {
+      unsigned char c = s[i];
+      if(c == '"' || c == '\\') {
+         out += '\\';
+         out += c;
+      }
+      else if(c < 0x20) {
+         char escaped[8];
+         snprintf(escaped,sizeof(escaped),"\\u%04x",c);
+         out += escaped;
+      }
+      else {
+         out += c;
+      }
+   }
+   return out+"\"";
+}
+
+static string stream_name(const PvFile* pv, uint32_t id)
+{
+   const pv_stream& s = pv->stream(id);
+   ostringstream name;
+   name << pv->string(s.img) << ":" << pv->string(s.rtn) << " 0x" << hex << s.sa << dec << " " << s.sl;
+   return name.str();
+}
+
+//Writes rows of named counts as text tables, CSV rows or JSON arrays.
+//Every row is <section, rank, name, count, share of the section total>.
+class Report
+{
+public:
+   Report(OutputFormat format) : format(format), sections(0) {}
+
+   void begin()
+   {
+      if(format == CSV_OUTPUT) cout << "section,rank,name,count,share" << endl;
+      if(format == JSON_OUTPUT) cout << "{" << endl;
+   }
+
+   //a total, printed before the first section
+   void value(const string& key, uint64_t v)
+   {
+      ostringstream text;
+      text << v;
+      totals.push_back(make_pair(key,text.str()));
+   }
+
+   void value(const string& key, double v)
+   {
+      ostringstream text;
+      text << v;
+      totals.push_back(make_pair(key,text.str()));
+   }
+
+   void section(const string& title, const string& key, const vector<pair<string,uint64_t> >& rows, double total)
+   {
+      write_totals();
+      if(format == TEXT_OUTPUT) {
+         cout << endl << title << ":" << endl;
+         for(size_t i=0;i<rows.size();++i) {
+            char line[64];
+            snprintf(line,sizeof(line),"%4zu %20llu %6.2f%%  ",i+1,(unsigned long long)rows[i].second,
+                     total > 0 ? 100.0*rows[i].second/total : 0.0);
+            cout << line << rows[i].first << endl;
+         }
+      }
+      else if(format == CSV_OUTPUT) {
+         for(size_t i=0;i<rows.size();++i) {
+            cout << key << "," << i+1 << "," << csv_field(rows[i].first) << "," << rows[i].second << ","
+                 << (total > 0 ? rows[i].second/total : 0.0) << endl;
+         }
+      }
+      else {
+         cout << (sections++ ? ",\n" : "") << "  " << json_string(key) << ": [";
+         for(size_t i=0;i<rows.size();++i) {
+            cout << (i ? "," : "") << "\n    {\"name\": " << json_string(rows[i].first)
+                 << ", \"count\": " << rows[i].second
+                 << ", \"share\": " << (total > 0 ? rows[i].second/total : 0.0) << "}";
+         }
+         cout << "\n  ]";
+      }
+   }
+
+   void end()
+   {
+      write_totals();
+      if(format == JSON_OUTPUT) cout << "\n}" << endl;
+   }
+
+private:
+   void write_totals()
+   {
+      if(totals.empty()) return;
+      if(format == JSON_OUTPUT) cout << "  \"totals\": {";
+      for(size_t i=0;i<totals.size();++i) {
+         const string& key = totals[i].first;
+         const string& v = totals[i].second;
+         if(format == TEXT_OUTPUT) cout << key << ": " << v << endl;
+         else if(format == CSV_OUTPUT) cout << "totals,0," << csv_field(key) << "," << v << "," << endl;
+         else cout << (i ? "," : "") << "\n    " << json_string(key) << ": " << v;
+      }
+      if(format == JSON_OUTPUT) cout << "\n  }";
+      sections++;
+      totals.clear();
+   }
+
+   OutputFormat format;
+   int sections; //JSON members written so far
+   vector<pair<string,string> > totals;
+};
+
+static vector<ranked> sorted_top(vector<ranked> list)
+{
+   sort(list.begin(),list.end(),count_greater);
+   return list;
+}
+
+int main(int argc, char** argv)
+{
+   OutputFormat format = TEXT_OUTPUT;
+   uint32_t top = 20;
+   unsigned threads = parallel_cores();
+   vector<const char*> files;
+   for(int i=1;i<argc;++i) {
+      if(strcmp(argv[i],"-f") == 0 && i+1 < argc) {
+         ++i;
+         if(strcmp(argv[i],"csv") == 0) format = CSV_OUTPUT;
+         else if(strcmp(argv[i],"json") == 0) format = JSON_OUTPUT;
+         else format = TEXT_OUTPUT;
+      }
+      else if(strcmp(argv[i],"-n") == 0 && i+1 < argc) top = atoi(argv[++i]);
+      else if(strcmp(argv[i],"-j") == 0 && i+1 < argc) threads = max(1,atoi(argv[++i]));
+      else files.push_back(argv[i]);
+   }
+   if(files.empty() || files.size() > 2) {
+      cerr << "usage: pinvis-stats [-f text|csv|json] [-n top] [-j threads] <streamcount.bin> [timeline.bin]" << endl;
+      return 1;
+   }
+   if(!PvFile::is_pv(files[0])) {
+      cerr << files[0] << " is not a pv file; files from older versions of streamcount can be converted with pvconvert" << endl;
+      return 1;
+   }
+   PvFile* pv = PvFile::open(files[0]);
+   if(pv == NULL) {
+      cerr << "could not read " << files[0] << endl;
+      return 1;
+   }
+   const pv_header& h = pv->header();
+
+   //reduce slices of the stream table in parallel, then merge the slices
+   vector<StatsTask> tasks(threads);
+   for(unsigned i=0;i<threads;++i) {
+      tasks[i].pv = pv;
+      tasks[i].top = top;
+      tasks[i].nstrings = h.sections[PV_STRING_OFFSETS].size/sizeof(uint32_t);
+      tasks[i].scale = sampling_scale(h.sampling);
+   }
+   parallel_for(tasks,h.nstreams);
+
+   StatsTask& all = tasks[0];
+   tr1::unordered_map<uint64_t,uint64_t>& routines = all.routine_instructions;
+   for(unsigned i=1;i<threads;++i) {
+      StatsTask& t = tasks[i];
+      all.executions += t.executions;
+      all.instructions += t.instructions;
+      all.memrefs += t.memrefs;
+      all.edges += t.edges;
+      all.transition_count += t.transition_count;
+      for(size_t s=0;s<t.image_instructions.size();++s) all.image_instructions[s] += t.image_instructions[s];
+      for(tr1::unordered_map<uint64_t,uint64_t>::iterator it=t.routine_instructions.begin();it!=t.routine_instructions.end();++it) {
+         routines[it->first] += it->second;
+      }
+      for(size_t s=0;s<t.streams.size();++s) offer(&all.streams,top,t.streams[s].count,t.streams[s].a,0);
+      for(size_t s=0;s<t.transitions.size();++s) {
+         offer(&all.transitions,top,t.transitions[s].count,t.transitions[s].a,t.transitions[s].b);
+      }
+   }
+   vector<ranked> images, top_routines;
+   for(size_t s=0;s<all.image_instructions.size();++s) {
+      if(all.image_instructions[s]) offer(&images,top,all.image_instructions[s],s,0);
+   }
+   for(tr1::unordered_map<uint64_t,uint64_t>::iterator it=routines.begin();it!=routines.end();++it) {
+      offer(&top_routines,top,it->second,it->first >> 32,(uint32_t)it->first);
+   }
+
+   Report report(format);
+   report.begin();
+   report.value("streams",(uint64_t)h.nstreams);
+   report.value("stream executions",all.executions);
+   report.value("instructions executed",all.instructions);
+   report.value("memory references",all.memrefs);
+   report.value("memory reference ratio",all.instructions ? (double)all.memrefs/all.instructions : 0.0);
+   report.value("transitions",all.edges);
+   report.value("count scale",sampling_scale(h.sampling));
+
+   vector<pair<string,uint64_t> > rows;
+   vector<ranked> list = sorted_top(all.streams);
+   for(size_t i=0;i<list.size();++i) rows.push_back(make_pair(stream_name(pv,list[i].a),list[i].count));
+   report.section("top streams by executions","streams",rows,all.executions);
+
+   rows.clear();
+   list = sorted_top(top_routines);
+   for(size_t i=0;i<list.size();++i) {
+      rows.push_back(make_pair(string(pv->string(list[i].a))+":"+pv->string(list[i].b),list[i].count));
+   }
+   report.section("top routines by instructions executed","routines",rows,all.instructions);
+
+   rows.clear();
+   list = sorted_top(images);
+   for(size_t i=0;i<list.size();++i) rows.push_back(make_pair(string(pv->string(list[i].a)),list[i].count));
+   report.section("top images by instructions executed","images",rows,all.instructions);
+
+   rows.clear();
+   list = sorted_top(all.transitions);
+   for(size_t i=0;i<list.size();++i) {
+      rows.push_back(make_pair(stream_name(pv,list[i].a)+" -> "+stream_name(pv,list[i].b),list[i].count));
+   }
+   report.section("hottest transitions","transitions",rows,all.transition_count);
+
+   if(files.size() > 1) {
+      TimelineReader timeline;
+      if(!timeline.open(files[1])) {
+         cerr << "could not read " << files[1] << endl;
+         return 1;
+      }
+      rows.clear();
+      uint64_t calls = 0;
+      for(uint32_t t=0;t<timeline.threads();++t) {
+         ostringstream name;
+         name << "thread " << timeline.tid(t);
+         rows.push_back(make_pair(name.str(),timeline.calls(t)));
+         calls += timeline.calls(t);
+      }
+      report.section("timeline calls per thread","timeline",rows,calls);
+   }
+   report.end();
+   delete pv;
+   return 0;
+}
@@ -0,0 +1,136 @@
+//Converts a streamcount.bin written before the pv format (any of the
+//layouts in streamcount_format.h) to a pv file pinvis can map. Only the
+//earliest layout has stream addresses; other converted streams have sa 0.
+//
+//usage: pvconvert <old streamcount.bin> <pv file>
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <stdint.h>
+#include <string.h>
+
+#include "streamcount_format.h"
+#include "pvformat.h"
+
+using namespace std;
+
+//UINT32 size including the terminating NUL, then the bytes
+static string read_name(istream& in)
+{
+   uint32_t size = 0;
+   in.read((char*)&size,sizeof(uint32_t));
+   vector<char> name(size+1,0);
+   in.read(&name[0],size);
+   return &name[0];
+}
+
+//true if total records of this layout end exactly at the end of the file;
+//only reads the sizes
+static bool records_fit(istream& in, uint32_t total, size_t count_size, bool addressed)
+{
+   streampos start = in.tellg();
+   in.seekg(0,ios::end);
+   streamoff end = in.tellg();
+   in.seekg(start);
+   for(uint32_t i=0;i<total && in;++i) {
+      uint32_t sl = 0, size = 0;
+      int next_stream_count = 0;
+      if(addressed) in.seekg(sizeof(uint32_t),ios::cur);
+      in.read((char*)&sl,sizeof(uint32_t));
+      in.seekg((streamoff)sl*sizeof(int)+sizeof(uint32_t)+count_size,ios::cur);
+      for(int k=0;k<2;++k) {
+         in.read((char*)&size,sizeof(uint32_t));
+         in.seekg(size,ios::cur);
+      }
+      in.read((char*)&next_stream_count,sizeof(int));
+      if(next_stream_count < 0) break;
+      in.seekg((streamoff)next_stream_count*(sizeof(uint32_t)+count_size),ios::cur);
+      if(in && in.tellg() > end) break;
+   }
+   bool fit = in && in.tellg() == end;
+   in.clear();
+   in.seekg(start);
+   return fit;
+}
+
+int main(int argc, char** argv)
+{
+   if(argc != 3) {
+      cerr << "usage: pvconvert <old streamcount.bin> <pv file>" << endl;
+      return 1;
+   }
+   if(PvFile::is_pv(argv[1])) {
+      cerr << "pvconvert: " << argv[1] << " is already a pv file" << endl;
+      return 1;
+   }
+   ifstream in(argv[1],ios::binary);
+   if(!in) {
+      cerr << "pvconvert: could not open " << argv[1] << endl;
+      return 1;
+   }
+
+   uint32_t total_streams = 0;
+   in.read((char*)&total_streams,sizeof(uint32_t));
+   uint32_t version = 1;
+   uint32_t mode = STREAMCOUNT_MODE_STREAM;
+   streamcount_sampling sampling;
+   memset(&sampling,0,sizeof(sampling));
+   string window_rtns[2];
+   if(total_streams == STREAMCOUNT_MAGIC) {
+      in.read((char*)&version,sizeof(uint32_t));
+      if(version >= STREAMCOUNT_VERSION_COUNT64) in.read((char*)&mode,sizeof(uint32_t));
+      in.read((char*)&sampling,sizeof(sampling));
+      window_rtns[0] = read_name(in);
+      window_rtns[1] = read_name(in);
+      in.read((char*)&total_streams,sizeof(uint32_t));
+   }
+   //counts were 32-bit before version 3
+   size_t count_size = version >= STREAMCOUNT_VERSION_COUNT64 ? sizeof(uint64_t) : sizeof(uint32_t);
+   //the earliest legacy files put each stream's address before its record
+   bool addressed = version == 1 && !records_fit(in,total_streams,count_size,false)
+      && records_fit(in,total_streams,count_size,true);
+
+   PvWriter pv(mode,sampling);
+   if(!window_rtns[0].empty()) pv.start_rtn = pv.string(window_rtns[0]);
+   if(!window_rtns[1].empty()) pv.stop_rtn = pv.string(window_rtns[1]);
+   vector<int> insvalues;
+   uint64_t nedges = 0;
+   for(uint32_t i=0;i<total_streams && in;++i) {
+      uint32_t sa = 0, sl = 0, lscount = 0;
+      uint64_t scount = 0;
+      if(addressed) in.read((char*)&sa,sizeof(uint32_t));
+      in.read((char*)&sl,sizeof(uint32_t));
+      insvalues.resize(sl);
+      if(sl) in.read((char*)&insvalues[0],sizeof(int)*sl);
+      in.read((char*)&lscount,sizeof(uint32_t));
+      in.read((char*)&scount,count_size);
+      uint32_t img = pv.string(read_name(in));
+      uint32_t rtn = pv.string(read_name(in));
+      pv.stream(sa,sl,sl ? &insvalues[0] : NULL,lscount,scount,img,rtn);
+      int next_stream_count = 0;
+      in.read((char*)&next_stream_count,sizeof(int));
+      for(int j=0;j<next_stream_count;++j) {
+         uint32_t id = 0;
+         uint64_t times = 0;
+         in.read((char*)&id,sizeof(uint32_t));
+         in.read((char*)&times,count_size);
+         pv.edge(id,times);
+      }
+      nedges += next_stream_count;
+   }
+   if(!in) {
+      cerr << "pvconvert: " << argv[1] << " ends early" << endl;
+      return 1;
+   }
+
+   ofstream out(argv[2],ios::binary);
+   pv.write(out);
+   if(!out) {
+      cerr << "pvconvert: could not write " << argv[2] << endl;
+      return 1;
+   }
+   cout << total_streams << " streams, " << nedges << " edges" << endl;
+   return 0;
+}
@@ -0,0 +1,301 @@
+#ifndef PVFORMAT_H
+#define PVFORMAT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <ostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "name_table.h"
+#include "streamcount_format.h"
+
+//streamcount.bin as written by streamcount since the pv format, laid out so
+//pinvis can map the file and use it in place
+//
+//pv_header, then the sections it lists, each starting on an 8-byte boundary:
+//  PV_STRINGS         image and routine names, NUL-terminated, each stored once
+//  PV_STRING_OFFSETS  UINT32 per string: its offset in PV_STRINGS
+//  PV_STREAMS         fixed-size pv_stream records, indexed by stream id
+//  PV_INSVALS         Insvals packed 4 to a byte, low bits first; a stream's
+//                     Insvals start at its insval_first
+//  PV_EDGE_INDEX      UINT64 per stream plus one: the stream's first edge
+//  PV_EDGES           pv_edge successor records, grouped by stream
+//
+//Everything is little endian; PV_ENDIAN reads back byte-swapped on a
+//big-endian host, which pv_open() rejects instead of misreading.
+
+#define PV_MAGIC 0x43535650u //"PVSC"
+#define PV_VERSION 1
+#define PV_ENDIAN 0x01020304u
+#define PV_NO_STRING 0xffffffffu
+
+enum pv_section_type {
+   PV_STRINGS,
+   PV_STRING_OFFSETS,
+   PV_STREAMS,
+   PV_INSVALS,
+   PV_EDGE_INDEX,
+   PV_EDGES,
+   PV_SECTIONS //number of section types
+};
+
+typedef struct {
+   uint64_t offset; //from the start of the file
+   uint64_t size; //bytes
+} pv_section;
+
+typedef struct {
+   uint32_t magic;
+   uint32_t version;
+   uint32_t endian;
+   uint32_t mode; //streamcount_mode
+   uint32_t start_rtn; //string id, PV_NO_STRING if recording did not wait for a routine
+   uint32_t stop_rtn;
+   uint32_t nsections; //PV_SECTIONS when written
+   uint32_t reserved;
+   uint64_t nstreams;
+   uint64_t nedges;
+   uint64_t ninsvals;
+   streamcount_sampling sampling;
+   pv_section sections[PV_SECTIONS]; //indexed by pv_section_type
+} pv_header;
+
+typedef struct {
+   uint64_t sa; //stream starting address, 0 if converted from a file without one
+   uint64_t scount; //stream count -- how many times it has been executed
+   uint64_t insval_first; //index of its first Insval in PV_INSVALS
+   uint32_t sl; //stream length
+   uint32_t lscount; //number of memory-referencing instructions
+   uint32_t img; //string id of the image name
+   uint32_t rtn; //string id of the routine name
+} pv_stream;
+
+typedef struct {
+   uint32_t id; //successor stream
+   uint32_t reserved;
+   uint64_t count; //times it followed
+} pv_edge;
+
+//Insval i of a packed array
+inline int pv_insval(const uint8_t* packed, uint64_t i)
+{
+   return (packed[i>>2] >> ((i&3)*2)) & 3;
+}
+
+//Collects streams in id order and writes them as one pv file. Names are
+//interned as they are added; edges belong to the stream added last.
+class PvWriter
+{
+public:
+   PvWriter(uint32_t mode, const streamcount_sampling& sampling)
+      : start_rtn(PV_NO_STRING), stop_rtn(PV_NO_STRING), mode(mode), sampling(sampling), ninsvals(0)
+   {
+      edge_index.push_back(0);
+   }
+
+   uint32_t string(const std::string& name) { return names.intern(name); }
+
+   void stream(uint64_t sa, uint32_t sl, const int* insvalues, uint32_t lscount,
+               uint64_t scount, uint32_t img, uint32_t rtn)
+   {
+      pv_stream s;
+      s.sa = sa;
+      s.scount = scount;
+      s.insval_first = ninsvals;
+      s.sl = sl;
+      s.lscount = lscount;
+      s.img = img;
+      s.rtn = rtn;
+      streams.push_back(s);
+      insvals.resize((ninsvals+sl+3)/4,0);
+      for(uint32_t i=0;i<sl;++i,++ninsvals) {
+         insvals[ninsvals>>2] |= (insvalues[i]&3) << ((ninsvals&3)*2);
+      }
+      edge_index.push_back(edges.size());
+   }
+
+   void edge(uint32_t id, uint64_t count)
+   {
+      pv_edge e;
+      e.id = id;
+      e.reserved = 0;
+      e.count = count;
+      edges.push_back(e);
+      edge_index.back() = edges.size();
+   }
+
+   void write(std::ostream& out)
+   {
+      //strings and their offsets
+      std::vector<char> strings;
+      std::vector<uint32_t> offsets(names.size());
+      for(uint32_t i=0;i<names.size();++i) {
+         offsets[i] = strings.size();
+         const std::string& name = names.name(i);
+         strings.insert(strings.end(),name.c_str(),name.c_str()+name.size()+1);
+      }
+
+      pv_header h;
+      memset(&h,0,sizeof(h));
+      h.magic = PV_MAGIC;
+      h.version = PV_VERSION;
+      h.endian = PV_ENDIAN;
+      h.mode = mode;
+      h.start_rtn = start_rtn;
+      h.stop_rtn = stop_rtn;
+      h.nsections = PV_SECTIONS;
+      h.nstreams = streams.size();
+      h.nedges = edges.size();
+      h.ninsvals = ninsvals;
+      h.sampling = sampling;
+      const void* data[PV_SECTIONS] = { data_of(strings), data_of(offsets), data_of(streams),
+                                        data_of(insvals), data_of(edge_index), data_of(edges) };
+      uint64_t sizes[PV_SECTIONS] = { strings.size(), sizeof(uint32_t)*offsets.size(),
+                                      sizeof(pv_stream)*streams.size(), insvals.size(),
+                                      sizeof(uint64_t)*edge_index.size(), sizeof(pv_edge)*edges.size() };
+      uint64_t offset = sizeof(h);
+      for(int i=0;i<PV_SECTIONS;++i) {
+         h.sections[i].offset = offset;
+         h.sections[i].size = sizes[i];
+         offset += padded(sizes[i]);
+      }
+
+      static const char zeros[8] = { 0 };
+      out.write(reinterpret_cast <const char*>(&h),sizeof(h));
+      for(int i=0;i<PV_SECTIONS;++i) {
+         out.write(static_cast <const char*>(data[i]),sizes[i]);
+         out.write(zeros,padded(sizes[i])-sizes[i]);
+      }
+   }
+
+   uint32_t start_rtn; //string ids
+   uint32_t stop_rtn;
+
+private:
+   template<class T> static const void* data_of(const std::vector<T>& v) { return v.empty() ? NULL : &v[0]; }
+   static uint64_t padded(uint64_t size) { return (size+7) & ~(uint64_t)7; }
+
+   uint32_t mode;
+   streamcount_sampling sampling;
+   NameTable names;
+   std::vector<pv_stream> streams;
+   std::vector<uint8_t> insvals;
+   uint64_t ninsvals;
+   std::vector<uint64_t> edge_index;
+   std::vector<pv_edge> edges;
+};
+
+//A pv file mapped read-only; the pointers stay valid until it is deleted.
+class PvFile
+{
+public:
+   //map and check the file at path; NULL if it is not a readable pv file
+   static PvFile* open(const char* path)
+   {
+      int fd = ::open(path,O_RDONLY);
+      if(fd < 0) return NULL;
+      struct stat st;
+      if(fstat(fd,&st) != 0 || (size_t)st.st_size < sizeof(pv_header)) {
+         close(fd);
+         return NULL;
+      }
+      void* base = mmap(NULL,st.st_size,PROT_READ,MAP_SHARED,fd,0);
+      close(fd);
+      if(base == MAP_FAILED) return NULL;
+      PvFile* file = new PvFile(static_cast<const char*>(base),st.st_size);
+      if(!file->valid()) {
+         delete file;
+         return NULL;
+      }
+      return file;
+   }
+
+   //true if the file at path starts like a pv file, whether or not it is valid
+   static bool is_pv(const char* path)
+   {
+      int fd = ::open(path,O_RDONLY);
+      if(fd < 0) return false;
+      uint32_t magic = 0;
+      bool pv = read(fd,&magic,sizeof(magic)) == sizeof(magic) && magic == PV_MAGIC;
+      close(fd);
+      return pv;
+   }
+
+   ~PvFile() { munmap(const_cast<char*>(base),size); }
+
+   const pv_header& header() const { return *h; }
+   uint64_t streams() const { return h->nstreams; }
+   const pv_stream& stream(uint64_t id) const { return section<pv_stream>(PV_STREAMS)[id]; }
+   const uint8_t* insvals() const { return section<uint8_t>(PV_INSVALS); }
+   uint64_t strings() const { return h->sections[PV_STRING_OFFSETS].size/sizeof(uint32_t); }
+   const char* string(uint32_t id) const
+   {
+      if(id == PV_NO_STRING) return "";
+      return section<char>(PV_STRINGS)+section<uint32_t>(PV_STRING_OFFSETS)[id];
+   }
+   //the successors of stream id
+   const pv_edge* edges(uint64_t id, uint64_t* count) const
+   {
+      const uint64_t* index = section<uint64_t>(PV_EDGE_INDEX);
+      *count = index[id+1]-index[id];
+      return section<pv_edge>(PV_EDGES)+index[id];
+   }
+
+private:
+   PvFile(const char* base, size_t size)
+      : base(base), size(size), h(reinterpret_cast<const pv_header*>(base)) {}
+   PvFile(const PvFile&);
+   PvFile& operator=(const PvFile&);
+
+   template<class T> const T* section(int type) const
+   {
+      return reinterpret_cast<const T*>(base+h->sections[type].offset);
+   }
+
+   //header, section bounds and the indexes the accessors trust
+   bool valid() const
+   {
+      if(h->magic != PV_MAGIC || h->version != PV_VERSION || h->endian != PV_ENDIAN ||
+         h->nsections < PV_SECTIONS) return false;
+      for(int i=0;i<PV_SECTIONS;++i) {
+         const pv_section& s = h->sections[i];
+         if(s.offset%8 != 0 || s.offset > size || s.size > size-s.offset) return false;
+      }
+      uint64_t nstrings = h->sections[PV_STRING_OFFSETS].size/sizeof(uint32_t);
+      uint64_t nstrings_bytes = h->sections[PV_STRINGS].size;
+      if(nstrings_bytes > 0 && section<char>(PV_STRINGS)[nstrings_bytes-1] != 0) return false;
+      for(uint64_t i=0;i<nstrings;++i) {
+         if(section<uint32_t>(PV_STRING_OFFSETS)[i] >= nstrings_bytes) return false;
+      }
+      if(h->sections[PV_STREAMS].size != sizeof(pv_stream)*h->nstreams ||
+         h->sections[PV_EDGE_INDEX].size != sizeof(uint64_t)*(h->nstreams+1) ||
+         h->sections[PV_EDGES].size != sizeof(pv_edge)*h->nedges ||
+         h->sections[PV_INSVALS].size < (h->ninsvals+3)/4) return false;
+      const uint64_t* index = section<uint64_t>(PV_EDGE_INDEX);
+      if(index[0] != 0 || index[h->nstreams] != h->nedges) return false;
+      for(uint64_t i=0;i<h->nstreams;++i) {
+         const pv_stream& s = stream(i);
+         if(index[i] > index[i+1] || s.insval_first+s.sl > h->ninsvals ||
+            s.img >= nstrings || s.rtn >= nstrings) return false;
+      }
+      const pv_edge* edges = section<pv_edge>(PV_EDGES);
+      for(uint64_t i=0;i<h->nedges;++i) {
+         if(edges[i].id >= h->nstreams) return false;
+      }
+      if((h->start_rtn != PV_NO_STRING && h->start_rtn >= nstrings) ||
+         (h->stop_rtn != PV_NO_STRING && h->stop_rtn >= nstrings)) return false;
+      return true;
+   }
+
+   const char* base;
+   size_t size;
+   const pv_header* h;
+};
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef REPLAY_FORMAT_H
+#define REPLAY_FORMAT_H
+
+#include <stdint.h>
+
+//block event files, written by streamcount -events and replay_streams -save
+//and read by replay_streams -load
+//
+//UINT32 REPLAY_MAGIC, UINT32 REPLAY_VERSION, UINT32 block count, UINT32
+//event count, then per block UINT64 sa, UINT32 sl and sl INT32 Insvals,
+//then one UINT32 per event: the block index, with REPLAY_TAKEN set if a
+//branch is taken at the end of the block
+
+#define REPLAY_MAGIC 0x56455650u //"PVEV"
+#define REPLAY_VERSION 1
+#define REPLAY_TAKEN 0x80000000u //block indices stay below this
+
+#endif
@@ -0,0 +1,190 @@
+//Replay harness for the stream builder: feeds block and branch events to
+//StreamThread/StreamTable at full speed, without Pin, and reports events per
+//second and the memory the stream table needs per stream. Events are
+//synthetic (loops over a random control flow graph) or loaded from an event
+//file (replay_format.h): one saved by an earlier run, or one recorded from a
+//real target by streamcount -events.
+//
+//usage: replay_streams [-load file] [-save file] [-o streamcount file]
+//                      [blocks] [events] [percent of blocks ending in a taken branch]
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "stream_builder.h"
+#include "replay_format.h"
+
+using namespace std;
+
+typedef struct {
+   uint64_t sa;
+   vector<int> insvalues;
+} replay_block;
+
+static double now()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC,&ts);
+   return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+//blocks laid out in a text segment; execution falls through to the next
+//block or takes a branch, mostly back into a short loop, sometimes to a
+//hot block elsewhere
+static void synthesize(uint32_t nblocks, uint32_t nevents, uint32_t taken_percent,
+                       vector<replay_block>* blocks, vector<uint32_t>* events)
+{
+   srand(1);
+   blocks->resize(nblocks);
+   uint64_t sa = 0x400000;
+   for(uint32_t i=0;i<nblocks;++i) {
+      replay_block& b = (*blocks)[i];
+      b.sa = sa;
+      b.insvalues.resize(1 + rand()%12);
+      for(uint32_t j=0;j<b.insvalues.size();++j) {
+         b.insvalues[j] = rand()%3 == 0 ? (rand()%2 ? INS_READ : INS_WRITE) : INS_NORMAL;
+      }
+      sa += 4*b.insvalues.size() + (rand()%4)*4;
+   }
+
+   events->reserve(nevents);
+   uint32_t current = 0;
+   while(events->size() < nevents) {
+      bool taken = (uint32_t)(rand()%100) < taken_percent;
+      events->push_back(current | (taken ? REPLAY_TAKEN : 0));
+      if(!taken) {
+         current = (current+1)%nblocks;
+      }
+      else if(rand()%10 < 7) {
+         uint32_t back = rand()%4;
+         current = current > back ? current-back : 0;
+      }
+      else {
+         //a few blocks are hot: square the uniform draw to skew it
+         uint64_t r = rand()%nblocks;
+         current = (r*r)/nblocks;
+      }
+   }
+}
+
+static bool load(const char* path, vector<replay_block>* blocks, vector<uint32_t>* events)
+{
+   ifstream in(path,ios::binary);
+   uint32_t header[4];
+   if(!in.read((char*)header,sizeof(header)) || header[0] != REPLAY_MAGIC || header[1] != REPLAY_VERSION) {
+      return false;
+   }
+   blocks->resize(header[2]);
+   for(uint32_t i=0;i<header[2];++i) {
+      replay_block& b = (*blocks)[i];
+      uint32_t sl;
+      in.read((char*)&b.sa,sizeof(uint64_t));
+      in.read((char*)&sl,sizeof(uint32_t));
+      b.insvalues.resize(sl);
+      in.read((char*)&b.insvalues[0],sizeof(int)*sl);
+   }
+   events->resize(header[3]);
+   in.read((char*)&(*events)[0],sizeof(uint32_t)*header[3]);
+   return in.good();
+}
+
+static void save(const char* path, const vector<replay_block>& blocks, const vector<uint32_t>& events)
+{
+   ofstream out(path,ios::binary);
+   uint32_t header[4] = { REPLAY_MAGIC, REPLAY_VERSION, (uint32_t)blocks.size(), (uint32_t)events.size() };
+   out.write((const char*)header,sizeof(header));
+   for(uint32_t i=0;i<blocks.size();++i) {
+      uint32_t sl = blocks[i].insvalues.size();
+      out.write((const char*)&blocks[i].sa,sizeof(uint64_t));
+      out.write((const char*)&sl,sizeof(uint32_t));
+      out.write((const char*)&blocks[i].insvalues[0],sizeof(int)*sl);
+   }
+   out.write((const char*)&events[0],sizeof(uint32_t)*events.size());
+}
+
+int main(int argc, char** argv)
+{
+   const char* load_path = NULL;
+   const char* save_path = NULL;
+   const char* out_path = NULL;
+   vector<uint32_t> numbers;
+   for(int i=1;i<argc;++i) {
+      if(strcmp(argv[i],"-load") == 0 && i+1 < argc) load_path = argv[++i];
+      else if(strcmp(argv[i],"-save") == 0 && i+1 < argc) save_path = argv[++i];
+      else if(strcmp(argv[i],"-o") == 0 && i+1 < argc) out_path = argv[++i];
+      else numbers.push_back(atoi(argv[i]));
+   }
+   uint32_t nblocks = numbers.size()>0 ? numbers[0] : 100000;
+   uint32_t nevents = numbers.size()>1 ? numbers[1] : 20000000;
+   uint32_t taken_percent = numbers.size()>2 ? numbers[2] : 60;
+
+   vector<replay_block> blocks;
+   vector<uint32_t> events;
+   if(load_path) {
+      if(!load(load_path,&blocks,&events)) {
+         cerr << "replay_streams: could not read " << load_path << endl;
+         return 1;
+      }
+   }
+   else {
+      synthesize(nblocks,nevents,taken_percent,&blocks,&events);
+   }
+   if(save_path) save(save_path,blocks,events);
+
+   //the static part, as streamcount builds it at instrumentation time
+   NameTable img_names, rtn_names;
+   uint32_t img = img_names.intern("replay");
+   uint32_t rtn = rtn_names.intern("replay");
+   StreamTable<NullLock> table;
+   vector<const block_info*> infos(blocks.size());
+   vector<branch_site*> sites(blocks.size());
+   for(uint32_t i=0;i<blocks.size();++i) {
+      block_info* info = table.new_block(blocks[i].sa,blocks[i].insvalues.size(),img,rtn);
+      for(uint32_t j=0;j<info->sl;++j) {
+         info->insvalues[j] = blocks[i].insvalues[j];
+         if(info->insvalues[j] != INS_NORMAL) info->lscount++;
+      }
+      infos[i] = info;
+      sites[i] = table.new_site();
+   }
+
+   StreamThread thread;
+   double t0 = now();
+   for(uint32_t i=0;i<events.size();++i) {
+      uint32_t b = events[i] & ~REPLAY_TAKEN;
+      thread.block(infos[b]);
+      if(events[i] & REPLAY_TAKEN) thread.branch(&table,sites[b]);
+   }
+   double elapsed = now()-t0;
+   size_t thread_bytes = thread.ids.memory_bytes() +
+                         thread.entries.capacity()*sizeof(stream_table_entry*) +
+                         thread.scount.capacity()*sizeof(uint64_t) +
+                         thread.next_stream.capacity()*sizeof(SuccessorList);
+   for(uint32_t i=0;i<thread.next_stream.size();++i) thread_bytes += thread.next_stream[i].heap_bytes();
+   table.merge(thread,0);
+
+   uint32_t streams = table.size();
+   cout << "blocks: " << blocks.size() << ", events: " << events.size() << endl;
+   cout << "streams: " << streams << " unique, " << table.numStreamD << " executed" << endl;
+   cout << "events/s: " << events.size()/elapsed << " (" << elapsed*1e9/events.size() << " ns/event)" << endl;
+   if(streams > 0) {
+      cout << "bytes/stream: " << (double)table.memory_bytes()/streams << " shared table, "
+           << (double)thread_bytes/streams << " per thread" << endl;
+   }
+
+   if(out_path) {
+      ofstream out(out_path,ios::binary);
+      streamcount_sampling sampling;
+      memset(&sampling,0,sizeof(sampling));
+      sampling.total_icount = table.numIrefs;
+      sampling.recorded_icount = table.numIrefs;
+      table.write(out,STREAMCOUNT_MODE_STREAM,sampling,"","",img_names,rtn_names);
+   }
+   return 0;
+}
@@ -0,0 +1,196 @@
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+//Single-producer/single-consumer ring of variable-sized messages in a
+//shared file mapping (normally under /dev/shm). The producer only stores
+//head and the consumer only stores tail, so neither side takes a lock; a
+//full ring makes push() fail instead of waiting, and the producer decides
+//whether to retry later or count the message as dropped.
+//
+//Each message is a shm_ring_message followed by its payload, padded to 8
+//bytes. A message never wraps: when it does not fit before the end of the
+//data area, the rest of the area is filled with a SHM_RING_PAD message.
+
+#define SHM_RING_MAGIC 0x474e5250u //"PRNG"
+#define SHM_RING_VERSION 1
+#define SHM_RING_PAD 0 //message type that only skips to the end of the data area
+
+typedef struct {
+   uint32_t magic;
+   uint32_t version;
+   uint64_t capacity; //bytes of message data, a power of two
+   volatile uint64_t dropped; //messages the producer gave up on
+   volatile uint64_t dropped_bytes;
+   char pad0[32];
+   volatile uint64_t head; //bytes ever written, stored by the producer
+   char pad1[56];
+   volatile uint64_t tail; //bytes ever consumed, stored by the consumer
+   char pad2[56];
+} shm_ring_header;
+
+typedef struct {
+   uint32_t type;
+   uint32_t size; //payload bytes, not counting padding
+} shm_ring_message;
+
+class ShmRing
+{
+public:
+   //create (or truncate) the ring at path for the producer; NULL on failure
+   static ShmRing* create(const char* path, uint64_t capacity)
+   {
+      if(capacity < 64 || (capacity & (capacity-1)) != 0) return NULL;
+      int fd = open(path,O_RDWR|O_CREAT|O_TRUNC,0600);
+      if(fd < 0) return NULL;
+      size_t size = sizeof(shm_ring_header)+capacity;
+      if(ftruncate(fd,size) != 0) {
+         close(fd);
+         return NULL;
+      }
+      ShmRing* ring = map(fd,size);
+      if(ring == NULL) return NULL;
+      shm_ring_header* h = ring->header;
+      h->capacity = capacity;
+      h->dropped = 0;
+      h->dropped_bytes = 0;
+      h->head = 0;
+      h->tail = 0;
+      h->version = SHM_RING_VERSION;
+      __sync_synchronize();
+      h->magic = SHM_RING_MAGIC; //last, so a consumer never sees a half-made ring
+      return ring;
+   }
+
+   //attach the consumer to the ring at path; NULL if it is not there yet
+   static ShmRing* attach(const char* path)
+   {
+      int fd = open(path,O_RDWR);
+      if(fd < 0) return NULL;
+      struct stat st;
+      if(fstat(fd,&st) != 0 || (size_t)st.st_size <= sizeof(shm_ring_header)) {
+         close(fd);
+         return NULL;
+      }
+      ShmRing* ring = map(fd,st.st_size);
+      if(ring == NULL) return NULL;
+      shm_ring_header* h = ring->header;
+      if(h->magic != SHM_RING_MAGIC || h->version != SHM_RING_VERSION ||
+         sizeof(shm_ring_header)+h->capacity != (uint64_t)st.st_size) {
+         delete ring;
+         return NULL;
+      }
+      return ring;
+   }
+
+   ~ShmRing()
+   {
+      munmap(header,size);
+      close(fd);
+   }
+
+   //producer: append a message; false if the ring has no room for it now
+   bool push(uint32_t type, const void* payload, uint32_t payload_size)
+   {
+      uint64_t capacity = header->capacity;
+      uint64_t need = sizeof(shm_ring_message)+padded(payload_size);
+      if(need > capacity/2) return false;
+      uint64_t head = header->head;
+      __sync_synchronize();
+      uint64_t used = head-header->tail;
+      uint64_t offset = head & (capacity-1);
+      uint64_t skip = capacity-offset < need ? capacity-offset : 0;
+      if(used+skip+need > capacity) return false;
+
+      if(skip != 0) {
+         shm_ring_message* pad = reinterpret_cast<shm_ring_message*>(data+offset);
+         pad->type = SHM_RING_PAD;
+         pad->size = skip-sizeof(shm_ring_message);
+         head += skip;
+         offset = 0;
+      }
+      shm_ring_message* msg = reinterpret_cast<shm_ring_message*>(data+offset);
+      msg->type = type;
+      msg->size = payload_size;
+      memcpy(msg+1,payload,payload_size);
+      __sync_synchronize();
+      header->head = head+need;
+      return true;
+   }
+
+   //producer: count a message that will not be sent
+   void drop(uint32_t payload_size)
+   {
+      header->dropped++;
+      header->dropped_bytes += payload_size;
+   }
+
+   //consumer: the oldest message, valid until pop(); false if there is none
+   bool peek(uint32_t* type, const void** payload, uint32_t* payload_size)
+   {
+      uint64_t capacity = header->capacity;
+      for(;;) {
+         uint64_t tail = header->tail;
+         uint64_t head = header->head;
+         __sync_synchronize();
+         if(tail == head) return false;
+         const shm_ring_message* msg = reinterpret_cast<const shm_ring_message*>(data+(tail & (capacity-1)));
+         if(msg->type == SHM_RING_PAD) {
+            __sync_synchronize();
+            header->tail = tail+sizeof(shm_ring_message)+msg->size;
+            continue;
+         }
+         *type = msg->type;
+         *payload = msg+1;
+         *payload_size = msg->size;
+         return true;
+      }
+   }
+
+   //consumer: release the message returned by peek()
+   void pop()
+   {
+      uint64_t tail = header->tail;
+      const shm_ring_message* msg = reinterpret_cast<const shm_ring_message*>(data+(tail & (header->capacity-1)));
+      uint64_t size = sizeof(shm_ring_message)+padded(msg->size);
+      __sync_synchronize();
+      header->tail = tail+size;
+   }
+
+   uint64_t dropped() const { return header->dropped; }
+   uint64_t pending() const { return header->head-header->tail; }
+   uint64_t capacity() const { return header->capacity; }
+
+private:
+   ShmRing(int fd, size_t size, void* base)
+      : fd(fd), size(size), header(static_cast<shm_ring_header*>(base)),
+        data(static_cast<char*>(base)+sizeof(shm_ring_header)) {}
+   ShmRing(const ShmRing&);
+   ShmRing& operator=(const ShmRing&);
+
+   static ShmRing* map(int fd, size_t size)
+   {
+      void* base = mmap(NULL,size,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+      if(base == MAP_FAILED) {
+         close(fd);
+         return NULL;
+      }
+      return new ShmRing(fd,size,base);
+   }
+
+   static uint64_t padded(uint64_t size) { return (size+7) & ~(uint64_t)7; }
+
+   int fd;
+   size_t size;
+   shm_ring_header* header;
+   char* data;
+};
+
+#endif
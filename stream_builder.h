@@ -0,0 +1,355 @@
+#ifndef STREAM_BUILDER_H
+#define STREAM_BUILDER_H
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <ostream>
+
+#include "stream_hash.h"
+#include "arena.h"
+#include "successors.h"
+#include "name_table.h"
+#include "streamcount_format.h"
+#include "pvformat.h"
+
+//Stream forming, independent of Pin. A stream is the run of instructions
+//between two taken branches; it is built from two events, a block about to
+//execute and a branch taken. streamcount drives this from its analysis
+//routines, replay_streams from synthetic or recorded events.
+
+enum Insval { INS_NORMAL, INS_READ, INS_WRITE };
+
+typedef struct {
+   uint64_t sa; //stream starting address
+   uint32_t sl; //stream length
+   uint32_t id; //index in the stream table
+   int*     insvalues; //array of Insval's, one for each instruction
+   uint64_t scount; //stream count -- how many times it has been executed
+   uint32_t lscount; //number of memory-referencing instructions
+   uint32_t nstream; //number of unique next streams
+   uint32_t img; //index into the image names
+   uint32_t rtn; //index into the routine names
+   SuccessorList next_stream; //<stream index,times executed> count how many times the next stream is encountered
+} stream_table_entry;
+
+//static description of a basic block, built once when it is instrumented
+typedef struct {
+   uint64_t sa; //block starting address
+   uint32_t sl; //number of instructions
+   uint32_t lscount; //number of memory-referencing instructions
+   uint32_t img; //index into the image names
+   uint32_t rtn; //index into the routine names
+   int*     insvalues; //array of Insval's, one for each instruction
+} block_info;
+
+//the stream being executed: the blocks run since the last taken branch
+typedef struct {
+   uint32_t sl;
+   uint32_t lscount;
+   std::vector<const block_info*> blocks; //cleared, never shrunk, so it stops allocating once warm
+} current_stream_state;
+
+//per call site cache of the stream that last ended at a taken branch; loops
+//usually end the same stream at the same branch so this skips the hash lookup.
+//Shared by all threads: table entries never change identity once published,
+//so a racing reader sees either the old or the new entry.
+typedef struct {
+   stream_table_entry* volatile entry; //NULL if empty
+} branch_site;
+
+//StreamTable lock for single-threaded users
+class NullLock
+{
+public:
+   void acquire(uint32_t) {}
+   void release() {}
+};
+
+template<class Lock> class StreamTable;
+
+//Everything one thread updates while running, so the hot path never takes a
+//lock except to add a stream the whole process has not seen yet. Counts are
+//folded into the shared table by StreamTable::merge() when the thread is done.
+class StreamThread
+{
+public:
+   enum { NO_STREAM = 0xffffffffu }; //an enum, so it can be passed by reference without a definition
+
+   StreamThread(uint32_t tid = 0)
+      : tid(tid), prev_stream_id(-1), numStreamD(0), numMemRef(0), numIrefs(0)
+   {
+      current.sl = 0;
+      current.lscount = 0;
+   }
+
+   //block b is about to execute
+   void block(const block_info* b)
+   {
+      numMemRef += b->lscount;
+      numIrefs += b->sl;
+      current.blocks.push_back(b);
+      current.sl += b->sl;
+      current.lscount += b->lscount;
+   }
+
+   //a branch was taken at site: store the current stream and start a new
+   //one; returns the id of the stream that ended, NO_STREAM if it was empty
+   template<class Lock>
+   uint32_t branch(StreamTable<Lock>* table, branch_site* site)
+   {
+      if(current.blocks.empty()) return NO_STREAM;
+      uint32_t id = lookup(table,site)->id;
+
+      //track number of times this stream was executed
+      scount[id]++;
+
+      //count the transition from the previous stream
+      if(prev_stream_id >= 0) {
+         next_stream[prev_stream_id].add(id);
+      }
+
+      //track total number of streams executed
+      numStreamD++;
+
+      //set previous stream ID and start an empty current stream
+      prev_stream_id = id;
+      clear();
+      return id;
+   }
+
+   //forget the current stream and the previous one, e.g. when recording pauses
+   void drop()
+   {
+      prev_stream_id = -1;
+      clear();
+   }
+
+   uint32_t tid;
+   current_stream_state current;
+   int32_t prev_stream_id; //the previously executed stream's index in the stream table
+   uint64_t numStreamD;
+   uint64_t numMemRef;
+   uint64_t numIrefs;
+   StreamHash ids; //streams this thread has seen, so lookups skip the table lock
+   std::vector<stream_table_entry*> entries; //indexed by stream id, NULL if not seen
+   std::vector<uint64_t> scount; //indexed by stream id
+   std::vector<SuccessorList> next_stream; //indexed by stream id
+
+private:
+   void clear()
+   {
+      current.blocks.clear();
+      current.sl = 0;
+      current.lscount = 0;
+   }
+
+   //resolve the current stream to its shared entry
+   template<class Lock>
+   stream_table_entry* lookup(StreamTable<Lock>* table, branch_site* site)
+   {
+      uint64_t sa = current.blocks[0]->sa;
+      uint32_t sl = current.sl;
+      stream_table_entry* entry = site->entry;
+      if(entry != NULL && entry->sa == sa && entry->sl == sl) return entry;
+
+      uint32_t id = ids.find(sa,sl);
+      if(id != StreamHash::NOT_FOUND) {
+         entry = entries[id];
+      }
+      else {
+         entry = table->find_or_add(&current,tid);
+         ids.insert(sa,sl,entry->id);
+         if(entry->id >= entries.size()) {
+            size_t size = entry->id+1 > entries.size()*2 ? entry->id+1 : entries.size()*2;
+            entries.resize(size,NULL);
+            scount.resize(size,0);
+            next_stream.resize(size);
+         }
+         entries[entry->id] = entry;
+      }
+      site->entry = entry;
+      return entry;
+   }
+};
+
+//The streams of the whole process. lock guards the index, the entries and
+//arenas behind it and the totals; users may hold it to guard their own
+//state that has to change together with the table.
+template<class Lock>
+class StreamTable
+{
+public:
+   StreamTable() : numStreamD(0), numMemRef(0), numIrefs(0), maxStreamLen(0) {}
+
+   //the shared entry for current, added to the table if it is new
+   stream_table_entry* find_or_add(const current_stream_state* current, uint32_t tid)
+   {
+      const block_info* head = current->blocks[0];
+      lock.acquire(tid);
+      uint32_t id = ids.find(head->sa,current->sl);
+      if(id != StreamHash::NOT_FOUND) {
+         stream_table_entry* entry = entries[id];
+         lock.release();
+         return entry;
+      }
+
+      stream_table_entry* entry = stream_arena.alloc();
+      entry->sa = head->sa;
+      entry->sl = current->sl;
+      entry->id = entries.size();
+      entry->scount = 0;
+      entry->lscount = current->lscount;
+      entry->nstream = 0;
+      entry->img = head->img;
+      entry->rtn = head->rtn;
+      entry->insvalues = insvalues_arena.alloc(current->sl);
+      int* insvalues = entry->insvalues;
+      for(uint32_t i=0;i<current->blocks.size();++i) {
+         const block_info* b = current->blocks[i];
+         memcpy(insvalues,b->insvalues,sizeof(int)*b->sl);
+         insvalues += b->sl;
+      }
+
+      entries.push_back(entry);
+      ids.insert(entry->sa,entry->sl,entry->id);
+      if(entry->sl > maxStreamLen) maxStreamLen = entry->sl;
+      lock.release();
+      return entry;
+   }
+
+   //number of streams; hold lock if other threads may be adding
+   uint32_t size() const { return entries.size(); }
+
+   stream_table_entry* entry(uint32_t id) const { return entries[id]; }
+
+   //a block with room for sl Insvals; blocks and sites are made by one
+   //instrumentation thread at a time and live as long as the table
+   block_info* new_block(uint64_t sa, uint32_t sl, uint32_t img, uint32_t rtn)
+   {
+      block_info* block = block_arena.alloc();
+      block->sa = sa;
+      block->sl = sl;
+      block->lscount = 0;
+      block->img = img;
+      block->rtn = rtn;
+      block->insvalues = block_insvalues_arena.alloc(sl);
+      return block;
+   }
+
+   branch_site* new_site()
+   {
+      branch_site* site = site_arena.alloc();
+      site->entry = NULL;
+      return site;
+   }
+
+   //fold the counts of a finished thread into the table
+   void merge(const StreamThread& t, uint32_t tid)
+   {
+      lock.acquire(tid);
+      for(uint32_t id=0;id<t.entries.size();++id) {
+         stream_table_entry* entry = t.entries[id];
+         if(entry == NULL) continue;
+         entry->scount += t.scount[id];
+         const SuccessorList& next_stream = t.next_stream[id];
+         for(SuccessorList::const_iterator it=next_stream.begin();it!=next_stream.end();++it) {
+            entry->next_stream.add(it->id,it->count);
+         }
+      }
+      numStreamD += t.numStreamD;
+      numMemRef += t.numMemRef;
+      numIrefs += t.numIrefs;
+      lock.release();
+   }
+
+   //count mode keeps no per-thread totals; derive them from the stream counts
+   void totals_from_counts()
+   {
+      for(uint32_t i=0;i<entries.size();++i) {
+         stream_table_entry* entry = entries[i];
+         numStreamD += entry->scount;
+         numIrefs += entry->scount*entry->sl;
+         numMemRef += entry->scount*entry->lscount;
+      }
+   }
+
+   //write streamcount.bin in the pv format
+   void write(std::ostream& out, uint32_t mode, const streamcount_sampling& sampling,
+              const std::string& start_rtn, const std::string& stop_rtn,
+              const NameTable& img_names, const NameTable& rtn_names) const
+   {
+      PvWriter pv(mode,sampling);
+      if(!start_rtn.empty()) pv.start_rtn = pv.string(start_rtn);
+      if(!stop_rtn.empty()) pv.stop_rtn = pv.string(stop_rtn);
+      for(uint32_t i=0;i<entries.size();++i) {
+         const stream_table_entry* entry = entries[i];
+         pv.stream(entry->sa,entry->sl,entry->insvalues,entry->lscount,entry->scount,
+                   pv.string(img_names.name(entry->img)),pv.string(rtn_names.name(entry->rtn)));
+         for(SuccessorList::const_iterator it=entry->next_stream.begin();it!=entry->next_stream.end();++it) {
+            pv.edge(it->id,it->count);
+         }
+      }
+      pv.write(out);
+   }
+
+   //human-readable totals and streams, as in debug.txt
+   void write_debug(std::ostream& out) const
+   {
+      //write global stats
+      out << "numStreamS: " << entries.size() << std::endl;
+      out << "numStreamD: " << numStreamD << std::endl;
+      out << "numMemRef: "  << numMemRef << std::endl;
+      out << "numIrefs: " << numIrefs << std::endl;
+      out << "maxStreamLen: " << maxStreamLen << std::endl;
+      out << "avgStreamLen: " << (double)numIrefs/numStreamD << std::endl;
+
+      //write streams
+      for(uint32_t i=0;i<entries.size();++i) {
+         const stream_table_entry* entry = entries[i];
+
+         out << i << ": (0x" << std::hex << entry->sa << ", " << std::dec <<
+                entry->sl << ", " << entry->lscount << "), "
+             << "(" << entry->scount << "); " ;
+
+         out << "{ ";
+         for(SuccessorList::const_iterator it=entry->next_stream.begin();it!=entry->next_stream.end();++it) {
+            out << "(" << it->id << "," << it->count << ")";
+         }
+         out << " }" << std::endl;
+      }
+   }
+
+   //bytes held for the streams: entries, their Insvals, successor tables and the index
+   size_t memory_bytes() const
+   {
+      size_t bytes = ids.memory_bytes() + entries.capacity()*sizeof(stream_table_entry*);
+      for(uint32_t i=0;i<entries.size();++i) {
+         bytes += sizeof(stream_table_entry) + sizeof(int)*entries[i]->sl + entries[i]->next_stream.heap_bytes();
+      }
+      return bytes;
+   }
+
+   Lock lock;
+
+   //totals, merged from the per-thread counters
+   uint64_t numStreamD; //number of program streams executed (dynamic)
+   uint64_t numMemRef; //number of memory referencing instructions executed (dynamic)
+   uint64_t numIrefs; //number of instructions executed (dynamic)
+   uint32_t maxStreamLen; //max stream length (max # of instructions executed in sequence w/o branch)
+
+private:
+   StreamTable(const StreamTable&);
+   StreamTable& operator=(const StreamTable&);
+
+   StreamHash ids; //maps <address of block,length of block> to their index in entries
+   std::vector<stream_table_entry*> entries; //one entry for each unique (by address & length) stream
+   Arena<stream_table_entry> stream_arena; //backs entries
+   Arena<int> insvalues_arena; //backs stream_table_entry::insvalues
+   Arena<block_info> block_arena;
+   Arena<int> block_insvalues_arena; //backs block_info::insvalues
+   Arena<branch_site> site_arena;
+};
+
+#endif
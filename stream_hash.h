@@ -0,0 +1,96 @@
+#ifndef STREAM_HASH_H
+#define STREAM_HASH_H
+
+#include <stdint.h>
+#include <vector>
+
+//Open-addressing hash table mapping a stream key <start address,length> to the
+//stream's index in the stream_table. Linear probing over a power-of-two table
+//that is kept at most half full, so a lookup is usually a single cache line.
+//Indices are never removed, so there are no tombstones.
+class StreamHash
+{
+public:
+   static const uint32_t NOT_FOUND = 0xffffffff;
+
+   StreamHash(uint32_t initial_capacity = 1024)
+      : count(0)
+   {
+      uint32_t capacity = 16;
+      while(capacity < initial_capacity) capacity <<= 1;
+      init(capacity);
+   }
+
+   //returns the index stored for <sa,sl>, or NOT_FOUND
+   uint32_t find(uint64_t sa, uint32_t sl) const
+   {
+      uint32_t i = hash(sa,sl) & mask;
+      while(slots[i].id != NOT_FOUND) {
+         if(slots[i].sa == sa && slots[i].sl == sl) return slots[i].id;
+         i = (i+1) & mask;
+      }
+      return NOT_FOUND;
+   }
+
+   //stores id for <sa,sl> unless the key is already present; returns the stored index
+   uint32_t insert(uint64_t sa, uint32_t sl, uint32_t id)
+   {
+      if((count+1)*2 > slots.size()) grow();
+      uint32_t i = hash(sa,sl) & mask;
+      while(slots[i].id != NOT_FOUND) {
+         if(slots[i].sa == sa && slots[i].sl == sl) return slots[i].id;
+         i = (i+1) & mask;
+      }
+      slots[i].sa = sa;
+      slots[i].sl = sl;
+      slots[i].id = id;
+      count++;
+      return id;
+   }
+
+   uint32_t size() const { return count; }
+
+   //bytes held by the table
+   size_t memory_bytes() const { return slots.capacity()*sizeof(slot); }
+
+private:
+   struct slot {
+      uint64_t sa;
+      uint32_t sl;
+      uint32_t id;
+   };
+
+   std::vector<slot> slots;
+   uint32_t mask;
+   uint32_t count;
+
+   static uint32_t hash(uint64_t sa, uint32_t sl)
+   {
+      //fibonacci hashing; block addresses share their low bits so mix before folding
+      uint64_t h = (sa ^ ((uint64_t)sl << 40)) * 0x9E3779B97F4A7C15ULL;
+      return (uint32_t)(h >> 32) ^ (uint32_t)h;
+   }
+
+   void init(uint32_t capacity)
+   {
+      slot empty;
+      empty.sa = 0;
+      empty.sl = 0;
+      empty.id = NOT_FOUND;
+      slots.assign(capacity,empty);
+      mask = capacity-1;
+   }
+
+   void grow()
+   {
+      std::vector<slot> old;
+      old.swap(slots);
+      init(old.size()*2);
+      count = 0;
+      for(uint32_t i=0;i<old.size();++i) {
+         if(old[i].id != NOT_FOUND) insert(old[i].sa,old[i].sl,old[i].id);
+      }
+   }
+};
+
+#endif
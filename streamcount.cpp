@@ -1,108 +1,779 @@
 #include <iostream>
 #include <fstream>
-#include <map>
 #include <vector>
+#include <algorithm>
 #include <string.h>
+#include <stddef.h>
+#include <stdio.h>
 
 #include "pin.H"
+#include "arena.h"
+#include "timeline_format.h"
+#include "name_table.h"
+#include "streamcount_format.h"
+#include "stream_builder.h"
+#include "memory_format.h"
+#include "shm_ring.h"
+#include "live_format.h"
+#include "replay_format.h"
 
 using namespace std;
 
+//StreamTable lock for the target's threads
+class PinLock
+{
+public:
+   PinLock() { InitLock(&lock); }
+   VOID acquire(UINT32 tid) { GetLock(&lock,tid+1); }
+   VOID release() { ReleaseLock(&lock); }
+private:
+   PIN_LOCK lock;
+};
+
+//shared stream table; its lock also guards thread_states
+static StreamTable<PinLock> stream_table;
+
+//interned names; added from instrumentation callbacks, which Pin serializes,
+//and read by the -live writer thread, so names_lock guards both tables
+static PIN_LOCK names_lock;
+static NameTable img_names;
+static NameTable rtn_names;
+static vector<UINT32> img_name_index; //indexed by IMG_Id, assigned when the image loads
+static std::tr1::unordered_map<UINT32,UINT32> rtn_name_index; //RTN_Id -> index in rtn_names
+
+static UINT32 intern_name(NameTable* names, const string& name)
+{
+   GetLock(&names_lock,PIN_ThreadId()+1);
+   UINT32 id = names->intern(name);
+   ReleaseLock(&names_lock);
+   return id;
+}
+
+KNOB<string> KnobMode(KNOB_MODE_WRITEONCE, "pintool",
+   "mode", "stream", "stream: streams, successors and timeline; count: basic block counts only");
+
+//-mode count: every basic block is its own stream, found or added once in
+//Trace(), and the only analysis is count_block() bumping that stream's
+//counter, which Pin inlines. There are no successors and no timeline.
+//Like Pin's inscount the increment is not atomic, so threads running the
+//same block at the same time can lose counts.
+static BOOL count_mode = false;
+
+VOID PIN_FAST_ANALYSIS_CALL count_block(UINT64* counter)
+{
+   (*counter)++;
+}
+
+//one fixed-size piece of the timeline; owned by the target thread while
+//filling, and by the writer thread from when full is set until it is cleared
+typedef struct {
+   UINT32 calls[TIMELINE_CHUNK_CALLS];
+   UINT32 count;
+   UINT32 seq; //hand-off order, so chunks are written in call order
+   volatile BOOL full;
+} timeline_chunk;
+
+//double-buffered timeline of one target thread: calls are appended to the
+//active chunk while the writer thread drains the other one
+typedef struct {
+   timeline_chunk chunks[2];
+   UINT32 active;
+   UINT32 next_seq;
+   UINT32 tid;
+} timeline_buffer;
+
+//keep the compiler from sinking chunk stores below the hand-off flag
+#define COMPILER_BARRIER() __asm__ __volatile__("" ::: "memory")
+
+static ofstream TimelineFile;
+static PIN_LOCK timeline_lock; //serializes TimelineFile, timeline_buffers and the encoder
+static TimelineEncoder timeline_encoder;
+static vector<UINT8> timeline_packed; //encoded chunk, reused so the writer stops allocating
+static vector<timeline_buffer*> timeline_buffers;
+static PIN_SEMAPHORE timeline_ready; //set when a chunk is handed to the writer
+static PIN_THREAD_UID timeline_writer_uid;
+static volatile BOOL timeline_writer_stop = false;
+static BOOL timeline_writer_running = false; //the writer thread was started
+
+KNOB<string> KnobLive(KNOB_MODE_WRITEONCE, "pintool",
+   "live", "", "also publish streams, counts and the timeline on this shared memory ring for pinvis --live");
+
+KNOB<UINT64> KnobLiveSize(KNOB_MODE_WRITEONCE, "pintool",
+   "live_size", "16777216", "-live ring capacity in bytes (a power of two)");
+
+//-live: the timeline writer thread also publishes on a ShmRing for pinvis.
+//Every push happens under timeline_lock, so the ring has one producer at a
+//time, and none of them waits for the viewer: when the ring is full, counts
+//and timeline events are dropped (and counted in the ring) while stream
+//definitions are held back until the next round.
+static ShmRing* live_ring = NULL;
+static vector<stream_table_entry*> live_entries; //published streams, indexed by id
+static vector<UINT64> live_counts; //count mode: scount last published, indexed by id
+
+//push a message the viewer can do without; caller holds timeline_lock
+static VOID live_push(UINT32 type, const vector<char>& msg)
+{
+   if(!live_ring->push(type,&msg[0],msg.size())) live_ring->drop(msg.size());
+}
+
+//publish one stream definition; false if the ring is full
+static BOOL publish_stream(const stream_table_entry* entry)
+{
+   GetLock(&names_lock,PIN_ThreadId()+1);
+   string img_name = img_names.name(entry->img);
+   string rtn_name = rtn_names.name(entry->rtn);
+   ReleaseLock(&names_lock);
+
+   live_stream header;
+   header.id = entry->id;
+   header.sl = entry->sl;
+   header.lscount = entry->lscount;
+   header.img_size = img_name.size()+1;
+   header.rtn_size = rtn_name.size()+1;
+   vector<char> msg(sizeof(header)+sizeof(int)*entry->sl+header.img_size+header.rtn_size);
+   char* p = &msg[0];
+   memcpy(p,&header,sizeof(header));
+   p += sizeof(header);
+   memcpy(p,entry->insvalues,sizeof(int)*entry->sl);
+   p += sizeof(int)*entry->sl;
+   memcpy(p,img_name.c_str(),header.img_size);
+   p += header.img_size;
+   memcpy(p,rtn_name.c_str(),header.rtn_size);
+   return live_ring->push(LIVE_STREAM,&msg[0],msg.size());
+}
+
+//publish new streams and, in count mode, count deltas; caller holds timeline_lock
+static VOID publish_live(THREADID tid)
+{
+   //entries never change once they are in the table, so a snapshot is enough
+   vector<stream_table_entry*> added;
+   stream_table.lock.acquire(tid);
+   for(UINT32 id=live_entries.size();id<stream_table.size();++id) added.push_back(stream_table.entry(id));
+   stream_table.lock.release();
+   for(UINT32 i=0;i<added.size();++i) {
+      if(!publish_stream(added[i])) break;
+      live_entries.push_back(added[i]);
+   }
+
+   if(!count_mode) return;
+   live_counts.resize(live_entries.size(),0);
+   vector<live_count> deltas;
+   for(UINT32 id=0;id<live_entries.size();++id) {
+      UINT64 scount = live_entries[id]->scount;
+      if(scount == live_counts[id]) continue;
+      live_count delta;
+      delta.id = id;
+      delta.reserved = 0;
+      delta.delta = scount-live_counts[id];
+      deltas.push_back(delta);
+      live_counts[id] = scount;
+   }
+   for(UINT32 first=0;first<deltas.size();first+=LIVE_TIMELINE_CALLS) {
+      UINT32 n = min((UINT32)deltas.size()-first,(UINT32)LIVE_TIMELINE_CALLS);
+      vector<char> msg(sizeof(live_count)*n);
+      memcpy(&msg[0],&deltas[first],msg.size());
+      live_push(LIVE_COUNTS,msg);
+   }
+}
+
+//publish a timeline chunk, split into ring-sized messages; caller holds timeline_lock
+static VOID publish_timeline(UINT32 tid, const timeline_chunk* chunk)
+{
+   for(UINT32 first=0;first<chunk->count;first+=LIVE_TIMELINE_CALLS) {
+      timeline_chunk_header header;
+      header.tid = tid;
+      header.count = min(chunk->count-first,(UINT32)LIVE_TIMELINE_CALLS);
+      vector<char> msg(sizeof(header)+sizeof(UINT32)*header.count);
+      memcpy(&msg[0],&header,sizeof(header));
+      memcpy(&msg[sizeof(header)],chunk->calls+first,sizeof(UINT32)*header.count);
+      live_push(LIVE_TIMELINE,msg);
+   }
+}
+
+//encode one chunk and append it to the timeline file; caller holds timeline_lock
+static VOID write_timeline_chunk(UINT32 tid, timeline_chunk* chunk)
+{
+   if(chunk->count == 0) return;
+   timeline_encoder.encode(chunk->calls,chunk->count,&timeline_packed);
+   timeline_packed_header header;
+   header.tid = tid;
+   header.count = chunk->count;
+   header.bytes = timeline_packed.size();
+   header.reserved = 0;
+   TimelineFile.write(reinterpret_cast <const char*>(&header),sizeof(header));
+   TimelineFile.write(reinterpret_cast <const char*>(&timeline_packed[0]),timeline_packed.size());
+}
+
+//write out every chunk that has been handed off
+static VOID drain_timeline(THREADID tid)
+{
+   GetLock(&timeline_lock,tid+1);
+   //streams first, so the viewer knows every id in the chunks that follow
+   if(live_ring) publish_live(tid);
+   BOOL wrote = false;
+   for(UINT32 i=0;i<timeline_buffers.size();++i) {
+      timeline_buffer* buffer = timeline_buffers[i];
+      //snapshot the flags first: only chunks full at this point are ours to order
+      BOOL full[2] = { buffer->chunks[0].full, buffer->chunks[1].full };
+      UINT32 first = full[0] && full[1] && buffer->chunks[1].seq < buffer->chunks[0].seq ? 1 : 0;
+      for(UINT32 c=0;c<2;++c) {
+         timeline_chunk* chunk = &buffer->chunks[first^c];
+         if(!full[first^c]) continue;
+         write_timeline_chunk(buffer->tid,chunk);
+         if(live_ring) publish_timeline(buffer->tid,chunk);
+         chunk->count = 0;
+         COMPILER_BARRIER();
+         chunk->full = false;
+         wrote = true;
+      }
+   }
+   //flush per chunk so the data is on disk if the target is killed
+   if(wrote) TimelineFile.flush();
+   ReleaseLock(&timeline_lock);
+}
+
+//Pin internal thread: drains full timeline chunks and publishes -live updates until told to stop
+static VOID timeline_writer(VOID* arg)
+{
+   THREADID tid = PIN_ThreadId();
+   while(!timeline_writer_stop) {
+      PIN_SemaphoreTimedWait(&timeline_ready,100);
+      PIN_SemaphoreClear(&timeline_ready);
+      drain_timeline(tid);
+   }
+}
+
+static VOID init_timeline_buffer(timeline_buffer* buffer, UINT32 tid)
+{
+   buffer->chunks[0].count = 0;
+   buffer->chunks[0].full = false;
+   buffer->chunks[1].count = 0;
+   buffer->chunks[1].full = false;
+   buffer->active = 0;
+   buffer->next_seq = 0;
+   buffer->tid = tid;
+}
+
+//record one stream call; hands the chunk to the writer thread when it fills
+static inline VOID timeline_append(timeline_buffer* buffer, UINT32 id)
+{
+   timeline_chunk* chunk = &buffer->chunks[buffer->active];
+   chunk->calls[chunk->count++] = id;
+   if(chunk->count < TIMELINE_CHUNK_CALLS) return;
+
+   chunk->seq = buffer->next_seq++;
+   COMPILER_BARRIER();
+   chunk->full = true;
+   PIN_SemaphoreSet(&timeline_ready);
+   buffer->active ^= 1;
+
+   //back-pressure: only wait if the writer has not drained the other chunk yet;
+   //once it is told to stop (Fini retiring threads) nobody will, so drain here
+   while(buffer->chunks[buffer->active].full) {
+      if(timeline_writer_stop || !timeline_writer_running) drain_timeline(PIN_ThreadId());
+      else PIN_Sleep(1);
+   }
+}
+
+KNOB<UINT64> KnobStartIcount(KNOB_MODE_WRITEONCE, "pintool",
+   "start_icount", "0", "start recording after this many instructions");
+
+KNOB<UINT64> KnobStopIcount(KNOB_MODE_WRITEONCE, "pintool",
+   "stop_icount", "0", "stop recording after this many instructions (0: never)");
+
+KNOB<string> KnobStartRtn(KNOB_MODE_WRITEONCE, "pintool",
+   "start_rtn", "", "start recording on entry to this routine");
+
+KNOB<string> KnobStopRtn(KNOB_MODE_WRITEONCE, "pintool",
+   "stop_rtn", "", "stop recording on return from this routine");
+
+KNOB<UINT64> KnobSampleOn(KNOB_MODE_WRITEONCE, "pintool",
+   "sample_on", "0", "record this many instructions out of every -sample_period");
+
+KNOB<UINT64> KnobSamplePeriod(KNOB_MODE_WRITEONCE, "pintool",
+   "sample_period", "0", "sampling period in instructions (0: no sampling)");
+
+//Recording gate for the window/sampling knobs. When any is given, every block
+//first runs gate_count(), a small inlinable If-call that counts instructions,
+//and the stream analysis only runs behind an is_recording() If-call, so
+//periods that are not recorded cost two inlined checks per block.
+//gate_icount is updated without a lock, so with several threads the window
+//edges are approximate.
+static BOOL gating = false; //any window/sampling knob given
+static volatile BOOL recording = true;
+static volatile UINT32 gate_epoch = 0; //bumped whenever recording changes
+static UINT64 gate_icount = 0; //instructions executed by the target
+static UINT64 gate_next = 0; //gate_icount at which recording next changes
+static BOOL rtn_started = false; //-start_rtn has been entered
+static BOOL stopped = false; //-stop_icount passed or -stop_rtn returned
+static PIN_LOCK gate_lock;
+
+//recompute recording and gate_next for the current gate_icount; caller holds gate_lock
+static VOID update_gate()
+{
+   UINT64 icount = gate_icount;
+   UINT64 start = KnobStartIcount.Value();
+   UINT64 stop = KnobStopIcount.Value();
+   UINT64 period = KnobSamplePeriod.Value();
+   UINT64 next = ~(UINT64)0;
+   BOOL on;
+   if(stop > 0 && icount >= stop) stopped = true;
+
+   if(stopped) {
+      on = false;
+   }
+   else if(icount < start) {
+      on = false;
+      next = start;
+   }
+   else if(!rtn_started) {
+      on = false;
+   }
+   else if(period > 0) {
+      UINT64 phase = (icount-start)%period;
+      on = phase < KnobSampleOn.Value();
+      next = icount + (on ? KnobSampleOn.Value()-phase : period-phase);
+   }
+   else {
+      on = true;
+   }
+   if(!stopped && stop > 0 && stop < next) next = stop;
+
+   gate_next = next;
+   if(recording != on) {
+      recording = on;
+      gate_epoch++;
+   }
+}
+
+ADDRINT PIN_FAST_ANALYSIS_CALL gate_count(UINT32 sl)
+{
+   gate_icount += sl;
+   return gate_icount >= gate_next;
+}
+
+VOID gate_cross(THREADID tid)
+{
+   GetLock(&gate_lock,tid+1);
+   if(gate_icount >= gate_next) update_gate();
+   ReleaseLock(&gate_lock);
+}
+
+ADDRINT PIN_FAST_ANALYSIS_CALL is_recording()
+{
+   return recording;
+}
+
+VOID start_rtn_entered(THREADID tid)
+{
+   GetLock(&gate_lock,tid+1);
+   rtn_started = true;
+   update_gate();
+   ReleaseLock(&gate_lock);
+}
+
+VOID stop_rtn_returned(THREADID tid)
+{
+   GetLock(&gate_lock,tid+1);
+   stopped = true;
+   update_gate();
+   ReleaseLock(&gate_lock);
+}
+
+KNOB<BOOL> KnobMemory(KNOB_MODE_WRITEONCE, "pintool",
+   "memory", "0", "record the addresses each stream accesses");
+
+KNOB<string> KnobMemoryFile(KNOB_MODE_WRITEONCE, "pintool",
+   "m", "memory.bin", "specify memory access output file name");
+
+//-memory: the effective address of every memory operand is stored into a Pin
+//trace buffer and aggregated per stream only when the buffer fills, so an
+//access costs a few inlined stores. In stream mode a record names its stream
+//by ordinal within the thread, kept in a tool register that branch_taken()
+//advances and resolved to a stream id once the stream has ended; in count
+//mode the stream id is known at Trace() time and stored directly.
+static BOOL memory_tracing = false;
+static BUFFER_ID memory_buffer;
+static REG ordinal_reg; //stream mode: ordinal of the thread's current stream
+#define MEMORY_BUFFER_PAGES 256
+
+//one memory operand of one instruction, for its stride; shared by all
+//threads, so strides of threads running the same code interleave
 typedef struct {
-   ADDRINT sa; //stream starting address
-   UINT32  sl; //stream length
-   vector<int> insvalues; //array of Insval's, one for each instruction
-   UINT32  scount; //stream count -- how many times it has been executed
-   UINT32  lscount; //number of memory-referencing instructions
-   UINT32  nstream; //number of unique next streams
-   UINT32  img; //index into img_name_list
-   UINT32  rtn; //index into rtn_name_list
-   map<UINT32,UINT32> next_stream; //<stream index,times executed> count how many times the next stream is encountered
-} stream_table_entry;
+   ADDRINT last_ea;
+   BOOL seen;
+} mem_site;
 
-typedef pair<ADDRINT,UINT32> key; //<address of block,length of block>
-typedef map<key,UINT32> stream_map; //<block key,index in stream_table>
+typedef struct {
+   ADDRINT stream; //ordinal (stream mode) or stream id (count mode)
+   ADDRINT ea;
+   mem_site* site;
+   UINT32 write;
+} mem_ref;
 
-enum Insval { INS_NORMAL, INS_READ, INS_WRITE };
+//what one stream accessed
+typedef struct {
+   UINT64 reads;
+   UINT64 writes;
+   UINT64 strides[MEMORY_STRIDE_BUCKETS];
+   std::tr1::unordered_map<UINT64,UINT64> pages; //page -> accesses
+   std::tr1::unordered_map<UINT64,UINT64> lines; //cache line -> accesses
+} stream_memory;
 
-static stream_map stream_ids; //maps block keys to their index in the stream_table
-static vector<stream_table_entry*> stream_table; //one entry for each unique (by address & length) block
+//memory_lock guards stream_memory_table and the mem_site strides
+static PIN_LOCK memory_lock;
+static vector<stream_memory*> stream_memory_table; //indexed by stream id, NULL if no accesses
+static Arena<mem_site> mem_site_arena; //allocated at instrumentation time
 
-static UINT32 numStreamD = 0; //number of program streams executed (dynamic)
-static UINT32 numMemRef = 0; //number of memory referencing instructions executed (dynamic)
-static UINT32 numIrefs = 0; //number of instructions executed (dynamic)
-static UINT32 maxStreamLen = 0; //max stream length (max # of instructions executed in sequence w/o branch)
+//count one access of stream id; caller holds memory_lock
+static VOID record_access(UINT32 id, const mem_ref* ref)
+{
+   if(id >= stream_memory_table.size()) stream_memory_table.resize(id+1,NULL);
+   stream_memory* m = stream_memory_table[id];
+   if(m == NULL) {
+      m = new stream_memory;
+      m->reads = 0;
+      m->writes = 0;
+      memset(m->strides,0,sizeof(m->strides));
+      stream_memory_table[id] = m;
+   }
+   if(ref->write) m->writes++;
+   else m->reads++;
+   m->pages[ref->ea >> MEMORY_PAGE_SHIFT]++;
+   m->lines[ref->ea >> MEMORY_LINE_SHIFT]++;
 
-static INT32 prev_stream_id = -1; //the previously executed stream's index in the stream_table
+   mem_site* site = ref->site;
+   if(site->seen) m->strides[stride_bucket(site->last_ea,ref->ea)]++;
+   site->last_ea = ref->ea;
+   site->seen = true;
+}
 
-static vector<string> img_name_list;
-static vector<string> rtn_name_list;
-static vector<UINT32> stream_call_order;
+//everything a target thread updates while running, kept in Pin TLS. The
+//stream counts are merged into the shared stream_table when the thread exits
+//(or at Fini for threads still running).
+typedef struct {
+   THREADID tid;
+   StreamThread stream;
+   timeline_buffer timeline;
+   UINT32 epoch; //gate_epoch the current stream was started in
+   UINT64 mem_base; //-memory: ordinal of mem_ids[0]
+   vector<UINT32> mem_ids; //-memory: ids of the streams ended since the last buffer flush
+   vector<mem_ref> mem_carry; //-memory: accesses of a stream still running at the last flush
+} thread_state;
 
-stream_table_entry* current_stream = new stream_table_entry;
+static TLS_KEY thread_key;
+static vector<thread_state*> thread_states; //live threads, guarded by stream_table.lock
 
-//called whenever a branch is taken: store current_stream and start a new one
-VOID branch_taken(ADDRINT sa)
+static inline thread_state* get_thread_state(THREADID tid)
 {
-   key k(current_stream->sa,current_stream->sl);
-   stream_map::iterator loc = stream_ids.find(k);
-   if(loc == stream_ids.end()) {
-       stream_table.push_back(current_stream);
-       stream_ids.insert(pair<key,UINT32>(k, stream_table.size()-1));
-       loc = stream_ids.find(k);
-       if(current_stream->sl > maxStreamLen) maxStreamLen = current_stream->sl;
+   return static_cast<thread_state*>(PIN_GetThreadData(thread_key,tid));
+}
+
+//-events: the block events of the first thread, in the event file format
+//(replay_format.h), so replay_streams -load can tune the stream builder on
+//a real workload. Blocks are numbered as they are first run. The blocks
+//come first in the file but are only all known at the end, so events go
+//to a temporary file until Fini puts the two together.
+KNOB<string> KnobEventsFile(KNOB_MODE_WRITEONCE, "pintool",
+   "events", "", "also write the first thread's block events to this file, for replay_streams -load");
+
+#define EVENTS_TID 0 //the thread whose events are recorded; only it touches the event state
+#define EVENTS_BUFFER_EVENTS (1u<<20) //events buffered before they go to the temporary file
+static BOOL events_recording = false;
+static ofstream EventsTemp;
+static vector<UINT32> event_buffer;
+static UINT64 events_written = 0; //to EventsTemp so far
+static vector<const block_info*> event_blocks; //by block index
+static std::tr1::unordered_map<const block_info*,UINT32> event_block_index;
+
+//record that the events thread runs block
+static VOID record_block_event(const block_info* block)
+{
+   //the event count is a UINT32; recording stops once it is full
+   if(events_written+event_buffer.size() == 0xffffffffu || event_blocks.size() == REPLAY_TAKEN) {
+      events_recording = false;
+      return;
+   }
+   UINT32 index;
+   std::tr1::unordered_map<const block_info*,UINT32>::iterator it = event_block_index.find(block);
+   if(it != event_block_index.end()) {
+      index = it->second;
+   }
+   else {
+      index = event_blocks.size();
+      event_blocks.push_back(block);
+      event_block_index.insert(make_pair(block,index));
    }
+   //flushed before a push, so the last event stays buffered for branch_taken to mark
+   if(event_buffer.size() == EVENTS_BUFFER_EVENTS) {
+      EventsTemp.write(reinterpret_cast <const char*>(&event_buffer[0]),sizeof(UINT32)*event_buffer.size());
+      events_written += event_buffer.size();
+      event_buffer.clear();
+   }
+   event_buffer.push_back(index);
+}
+
+//header, blocks, then the events from the temporary file
+static VOID write_events_file()
+{
+   if(!event_buffer.empty()) {
+      EventsTemp.write(reinterpret_cast <const char*>(&event_buffer[0]),sizeof(UINT32)*event_buffer.size());
+      events_written += event_buffer.size();
+   }
+   EventsTemp.close();
+   string temp = KnobEventsFile.Value()+".tmp";
+   ofstream EventsFile;
+   EventsFile.open(KnobEventsFile.Value().c_str(),ofstream::binary);
+   UINT32 header[4] = { REPLAY_MAGIC, REPLAY_VERSION, (UINT32)event_blocks.size(), (UINT32)events_written };
+   EventsFile.write(reinterpret_cast <const char*>(header),sizeof(header));
+   for(UINT32 i=0;i<event_blocks.size();++i) {
+      const block_info* block = event_blocks[i];
+      UINT64 sa = block->sa;
+      UINT32 sl = block->sl;
+      EventsFile.write(reinterpret_cast <const char*>(&sa),sizeof(UINT64));
+      EventsFile.write(reinterpret_cast <const char*>(&sl),sizeof(UINT32));
+      EventsFile.write(reinterpret_cast <const char*>(block->insvalues),sizeof(int)*sl);
+   }
+   ifstream events(temp.c_str(),ifstream::binary);
+   if(events_written) EventsFile << events.rdbuf();
+   events.close();
+   EventsFile.close();
+   remove(temp.c_str());
+}
+
+//drop a stream that straddles a change of the recording gate; returns false if it did
+static inline BOOL same_epoch(thread_state* ts)
+{
+   if(ts->epoch == gate_epoch) return true;
+   ts->epoch = gate_epoch;
+   ts->stream.drop();
+   return false;
+}
+
+//store the current stream of ts and start a new one
+static VOID end_stream(thread_state* ts, branch_site* site)
+{
+   if(!same_epoch(ts)) return;
+   UINT32 id = ts->stream.branch(&stream_table,site);
+   if(id == StreamThread::NO_STREAM) return;
 
    //update the timeline of stream calls
-   stream_call_order.push_back(loc->second);
+   timeline_append(&ts->timeline,id);
 
-   //track number of times this stream was executed
-   stream_table[loc->second]->scount++;
+   //let buffered accesses with this stream's ordinal be resolved
+   if(memory_tracing) ts->mem_ids.push_back(id);
+}
 
-   //add an entry to the previous stream's next_stream map
-   if(prev_stream_id >= 0) {
-       stream_table_entry* prev_stream = stream_table[prev_stream_id];
-       if(prev_stream->next_stream.find(loc->second) != prev_stream->next_stream.end()) {
-           prev_stream->next_stream[loc->second]++;
-       }
-       else {
-           prev_stream->next_stream.insert(pair<UINT32,UINT32>(loc->second,1));
-       }
+//called whenever a branch is taken; returns the ordinal of the stream that
+//starts, which -memory keeps in ordinal_reg
+ADDRINT branch_taken(branch_site* site, THREADID tid)
+{
+   thread_state* ts = get_thread_state(tid);
+   end_stream(ts,site);
+   if(events_recording && tid == EVENTS_TID && !event_buffer.empty()) event_buffer.back() |= REPLAY_TAKEN;
+   return ts->mem_base + ts->mem_ids.size();
+}
+
+//resolve n buffered accesses to their streams and count them; ts is NULL in
+//count mode. Accesses of a stream that has not ended yet are carried over.
+//A stream dropped at a recording gate change keeps its ordinal, so its
+//accesses go to the next stream. Caller holds memory_lock.
+static VOID aggregate_accesses(thread_state* ts, const mem_ref* refs, UINT64 n)
+{
+   for(UINT64 i=0;i<n;++i) {
+      const mem_ref* ref = &refs[i];
+      if(ts == NULL) {
+         record_access(ref->stream,ref);
+      }
+      else if(ref->stream - ts->mem_base < ts->mem_ids.size()) {
+         record_access(ts->mem_ids[ref->stream - ts->mem_base],ref);
+      }
+      else {
+         ts->mem_carry.push_back(*ref);
+      }
    }
+}
 
-   //track total number of streams executed
-   numStreamD++;
+//count the accesses carried over by ts
+static VOID aggregate_carry(thread_state* ts)
+{
+   vector<mem_ref> carry;
+   carry.swap(ts->mem_carry);
+   if(!carry.empty()) aggregate_accesses(ts,&carry[0],carry.size());
+}
 
-   //set previous stream ID and reset current stream to NULL
-   prev_stream_id = loc->second;
-   current_stream = NULL;
+//Pin calls this when a thread's trace buffer is full and when the thread exits
+VOID* memory_buffer_full(BUFFER_ID id, THREADID tid, const CONTEXT* ctxt, VOID* buf,
+                         UINT64 n, VOID* v)
+{
+   thread_state* ts = NULL;
+   if(!count_mode) {
+      ts = get_thread_state(tid);
+      if(ts == NULL) return buf;
+   }
+   GetLock(&memory_lock,tid+1);
+   if(ts != NULL) aggregate_carry(ts);
+   aggregate_accesses(ts,static_cast<const mem_ref*>(buf),n);
+   if(ts != NULL) {
+      //later accesses can only belong to the stream now running
+      ts->mem_base += ts->mem_ids.size();
+      ts->mem_ids.clear();
+   }
+   ReleaseLock(&memory_lock);
+   return buf;
 }
 
 //This function is called before every block
-VOID before_block(ADDRINT sa, UINT32 sl, void* insvalues,
-                  UINT32 lscount, UINT32 img, UINT32 rtn)
+VOID before_block(const block_info* block, THREADID tid)
+{
+   thread_state* ts = get_thread_state(tid);
+   same_epoch(ts);
+   ts->stream.block(block);
+   if(events_recording && tid == EVENTS_TID) record_block_event(block);
+}
+
+VOID ThreadStart(THREADID tid, CONTEXT *ctxt, INT32 flags, VOID *v)
+{
+   thread_state* ts = new thread_state;
+   ts->tid = tid;
+   ts->stream.tid = tid;
+   ts->epoch = gate_epoch;
+   ts->mem_base = 0;
+   if(memory_tracing) PIN_SetContextReg(ctxt,ordinal_reg,0);
+   init_timeline_buffer(&ts->timeline,tid);
+   PIN_SetThreadData(thread_key,ts,tid);
+
+   stream_table.lock.acquire(tid);
+   thread_states.push_back(ts);
+   stream_table.lock.release();
+
+   GetLock(&timeline_lock,tid+1);
+   timeline_buffers.push_back(&ts->timeline);
+   ReleaseLock(&timeline_lock);
+}
+
+//end the thread's last stream, write out its timeline and fold its counts
+//into the shared stream_table; tid is the thread doing the work
+static VOID retire_thread(thread_state* ts, THREADID tid)
 {
-   //increment counters
-   numMemRef+=lscount;
-   numIrefs+=sl;
+   //FIXME: hacky way of making sure the last stream gets tidied up
+   branch_site fini_site;
+   fini_site.entry = NULL;
+   end_stream(ts,&fini_site);
 
-   //create a new current_stream if needed
-   if(current_stream == NULL) {
-       current_stream = new stream_table_entry;
-       current_stream->sa = sa;
-       current_stream->sl = 0;
-       current_stream->lscount = 0;
-       current_stream->scount = 0;
-       current_stream->nstream = 0;
-       current_stream->img = img;
-       current_stream->rtn = rtn;
+   //the last stream has an id now; Pin has flushed the trace buffer before ThreadFini
+   if(memory_tracing) {
+      GetLock(&memory_lock,tid+1);
+      aggregate_carry(ts);
+      ReleaseLock(&memory_lock);
    }
 
-   //update current_stream values
-   current_stream->sl += sl;
-   current_stream->lscount += lscount;
-   for(unsigned int i=0;i<sl;++i) {
-      current_stream->insvalues.push_back(((int*)insvalues)[i]);
+   drain_timeline(tid);
+   GetLock(&timeline_lock,tid+1);
+   write_timeline_chunk(ts->tid,&ts->timeline.chunks[ts->timeline.active]);
+   if(live_ring) {
+      publish_live(tid);
+      publish_timeline(ts->tid,&ts->timeline.chunks[ts->timeline.active]);
+   }
+   timeline_buffers.erase(find(timeline_buffers.begin(),timeline_buffers.end(),&ts->timeline));
+   ReleaseLock(&timeline_lock);
+
+   stream_table.merge(ts->stream,tid);
+   stream_table.lock.acquire(tid);
+   thread_states.erase(find(thread_states.begin(),thread_states.end(),ts));
+   stream_table.lock.release();
+
+   delete ts;
+}
+
+VOID ThreadFini(THREADID tid, const CONTEXT *ctxt, INT32 code, VOID *v)
+{
+   retire_thread(get_thread_state(tid),tid);
+   PIN_SetThreadData(thread_key,NULL,tid);
+}
+
+//name recorded for code outside any known routine
+static const char* UNKNOWN_NAME = "[unknown]";
+
+//index in img_names of a loaded image
+static UINT32 image_index(IMG img)
+{
+   UINT32 id = IMG_Id(img);
+   if(id >= img_name_index.size() || img_name_index[id] == StreamHash::NOT_FOUND) {
+      //Trace() can see code of an image before its load callback has run
+      if(id >= img_name_index.size()) img_name_index.resize(id+1,StreamHash::NOT_FOUND);
+      img_name_index[id] = intern_name(&img_names,IMG_Name(img));
+   }
+   return img_name_index[id];
+}
+
+//Pin calls this function every time an image is loaded: name it once here
+//rather than on every trace
+VOID ImageLoad(IMG img, VOID *v)
+{
+   image_index(img);
+
+   if(!KnobStartRtn.Value().empty()) {
+      RTN rtn = RTN_FindByName(img,KnobStartRtn.Value().c_str());
+      if(RTN_Valid(rtn)) {
+         RTN_Open(rtn);
+         RTN_InsertCall(rtn, IPOINT_BEFORE, (AFUNPTR)start_rtn_entered, IARG_THREAD_ID, IARG_END);
+         RTN_Close(rtn);
+      }
+   }
+   if(!KnobStopRtn.Value().empty()) {
+      RTN rtn = RTN_FindByName(img,KnobStopRtn.Value().c_str());
+      if(RTN_Valid(rtn)) {
+         RTN_Open(rtn);
+         RTN_InsertCall(rtn, IPOINT_AFTER, (AFUNPTR)stop_rtn_returned, IARG_THREAD_ID, IARG_END);
+         RTN_Close(rtn);
+      }
+   }
+}
+
+//-memory: store the effective address of each memory operand of ins into the
+//trace buffer; entry is the block's stream in count mode, NULL otherwise
+static VOID instrument_memory(INS ins, const stream_table_entry* entry)
+{
+   for(UINT32 op=0;op<INS_MemoryOperandCount(ins);++op) {
+      mem_site* site = mem_site_arena.alloc();
+      site->last_ea = 0;
+      site->seen = false;
+      UINT32 write = INS_MemoryOperandIsWritten(ins,op);
+      if(gating) {
+         INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)is_recording,
+                          IARG_FAST_ANALYSIS_CALL, IARG_END);
+         if(entry != NULL)
+            INS_InsertFillBufferThen(ins, IPOINT_BEFORE, memory_buffer,
+                                     IARG_ADDRINT, (ADDRINT)entry->id, offsetof(mem_ref,stream),
+                                     IARG_MEMORYOP_EA, op, offsetof(mem_ref,ea),
+                                     IARG_PTR, site, offsetof(mem_ref,site),
+                                     IARG_UINT32, write, offsetof(mem_ref,write),
+                                     IARG_END);
+         else
+            INS_InsertFillBufferThen(ins, IPOINT_BEFORE, memory_buffer,
+                                     IARG_REG_VALUE, ordinal_reg, offsetof(mem_ref,stream),
+                                     IARG_MEMORYOP_EA, op, offsetof(mem_ref,ea),
+                                     IARG_PTR, site, offsetof(mem_ref,site),
+                                     IARG_UINT32, write, offsetof(mem_ref,write),
+                                     IARG_END);
+      }
+      else if(entry != NULL) {
+         INS_InsertFillBuffer(ins, IPOINT_BEFORE, memory_buffer,
+                              IARG_ADDRINT, (ADDRINT)entry->id, offsetof(mem_ref,stream),
+                              IARG_MEMORYOP_EA, op, offsetof(mem_ref,ea),
+                              IARG_PTR, site, offsetof(mem_ref,site),
+                              IARG_UINT32, write, offsetof(mem_ref,write),
+                              IARG_END);
+      }
+      else {
+         INS_InsertFillBuffer(ins, IPOINT_BEFORE, memory_buffer,
+                              IARG_REG_VALUE, ordinal_reg, offsetof(mem_ref,stream),
+                              IARG_MEMORYOP_EA, op, offsetof(mem_ref,ea),
+                              IARG_PTR, site, offsetof(mem_ref,site),
+                              IARG_UINT32, write, offsetof(mem_ref,write),
+                              IARG_END);
+      }
    }
 }
 
@@ -110,40 +781,27 @@ VOID before_block(ADDRINT sa, UINT32 sl, void* insvalues,
 VOID Trace(TRACE trace, VOID *v)
 {
    RTN rtn = TRACE_Rtn(trace);
-   UINT32 img_name_index=0, rtn_name_index=0;
+   UINT32 img_index, rtn_index;
    if(RTN_Valid(rtn)) {
-      string rtn_name = RTN_Name(rtn);
-      string img_name = IMG_Name(SEC_Img(RTN_Sec(rtn)));
-      bool found = false;
-      for(unsigned int i=0;i<img_name_list.size();++i) {
-         if(img_name.compare(img_name_list[i])==0) {
-            img_name_index = i;
-            found = true;
-            break;
-         }
-      }
-      if(!found) {
-         img_name_list.push_back(img_name);
-         img_name_index = img_name_list.size()-1;
+      img_index = image_index(SEC_Img(RTN_Sec(rtn)));
+      std::tr1::unordered_map<UINT32,UINT32>::iterator it = rtn_name_index.find(RTN_Id(rtn));
+      if(it != rtn_name_index.end()) {
+         rtn_index = it->second;
       }
-      found = false;
-      for(unsigned int i=0;i<rtn_name_list.size();++i) {
-         if(rtn_name.compare(rtn_name_list[i])==0) {
-            rtn_name_index = i;
-            found = true;
-            break;
-         }
-      }
-      if(!found) {
-	 rtn_name_list.push_back(rtn_name);
-	 rtn_name_index = rtn_name_list.size()-1;
+      else {
+         rtn_index = intern_name(&rtn_names,RTN_Name(rtn));
+         rtn_name_index.insert(make_pair(RTN_Id(rtn),rtn_index));
       }
    }
+   else {
+      img_index = intern_name(&img_names,UNKNOWN_NAME);
+      rtn_index = intern_name(&rtn_names,UNKNOWN_NAME);
+   }
 
    //Visit every basic block in the trace
    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
    {
-       int* insvals = new int[BBL_NumIns(bbl)];
+       block_info* block = stream_table.new_block(BBL_Address(bbl),BBL_NumIns(bbl),img_index,rtn_index);
        int insctr = 0;
        //count memory referencing instructions
        UINT32 memory_refs = 0;
@@ -155,106 +813,184 @@ VOID Trace(TRACE trace, VOID *v)
                ins_value = INS_WRITE;
            else
                ins_value = INS_NORMAL;
-           insvals[insctr++] = ins_value;
+           block->insvalues[insctr++] = ins_value;
            if(ins_value == INS_READ || ins_value == INS_WRITE)
                memory_refs++;
 
-           if(INS_IsBranchOrCall(ins)) {
-              INS_InsertCall(ins, IPOINT_TAKEN_BRANCH, (AFUNPTR)branch_taken,
-                             IARG_ADDRINT, BBL_Address(bbl), IARG_END);
+           if(INS_IsBranchOrCall(ins) && !count_mode) {
+              branch_site* site = stream_table.new_site();
+              if(gating) {
+                 INS_InsertIfCall(ins, IPOINT_TAKEN_BRANCH, (AFUNPTR)is_recording,
+                                  IARG_FAST_ANALYSIS_CALL, IARG_END);
+                 if(memory_tracing)
+                    INS_InsertThenCall(ins, IPOINT_TAKEN_BRANCH, (AFUNPTR)branch_taken,
+                                       IARG_PTR, site, IARG_THREAD_ID,
+                                       IARG_RETURN_REGS, ordinal_reg, IARG_END);
+                 else
+                    INS_InsertThenCall(ins, IPOINT_TAKEN_BRANCH, (AFUNPTR)branch_taken,
+                                       IARG_PTR, site, IARG_THREAD_ID, IARG_END);
+              }
+              else if(memory_tracing) {
+                 INS_InsertCall(ins, IPOINT_TAKEN_BRANCH, (AFUNPTR)branch_taken,
+                                IARG_PTR, site, IARG_THREAD_ID,
+                                IARG_RETURN_REGS, ordinal_reg, IARG_END);
+              }
+              else {
+                 INS_InsertCall(ins, IPOINT_TAKEN_BRANCH, (AFUNPTR)branch_taken,
+                                IARG_PTR, site, IARG_THREAD_ID, IARG_END);
+              }
            }
        }
+       block->lscount = memory_refs;
+
+       //in count mode the block is its own stream
+       stream_table_entry* entry = NULL;
+       if(count_mode) {
+          current_stream_state single;
+          single.sl = block->sl;
+          single.lscount = block->lscount;
+          single.blocks.push_back(block);
+          entry = stream_table.find_or_add(&single,PIN_ThreadId());
+       }
+
+       if(memory_tracing) {
+          for (INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins)) {
+             instrument_memory(ins,entry);
+          }
+       }
+
+       if(count_mode) {
+          if(gating) {
+             BBL_InsertIfCall(bbl, IPOINT_BEFORE, (AFUNPTR)gate_count,
+                              IARG_FAST_ANALYSIS_CALL, IARG_UINT32, block->sl, IARG_END);
+             BBL_InsertThenCall(bbl, IPOINT_BEFORE, (AFUNPTR)gate_cross,
+                                IARG_THREAD_ID, IARG_END);
+             BBL_InsertIfCall(bbl, IPOINT_BEFORE, (AFUNPTR)is_recording,
+                              IARG_FAST_ANALYSIS_CALL, IARG_END);
+             BBL_InsertThenCall(bbl, IPOINT_BEFORE, (AFUNPTR)count_block,
+                                IARG_FAST_ANALYSIS_CALL, IARG_PTR, &entry->scount, IARG_END);
+          }
+          else {
+             BBL_InsertCall(bbl, IPOINT_BEFORE, (AFUNPTR)count_block,
+                            IARG_FAST_ANALYSIS_CALL, IARG_PTR, &entry->scount, IARG_END);
+          }
+          continue;
+       }
 
        //Insert a call to before_block before every bbl
-       BBL_InsertCall(bbl, IPOINT_BEFORE, (AFUNPTR)before_block,
-                      IARG_ADDRINT, BBL_Address(bbl),
-                      IARG_UINT32,  BBL_NumIns(bbl),
-                      IARG_PTR,     insvals,
-                      IARG_UINT32,  memory_refs,
-                      IARG_UINT32,  img_name_index,
-                      IARG_UINT32,  rtn_name_index,
-                      IARG_END);
+       if(gating) {
+          BBL_InsertIfCall(bbl, IPOINT_BEFORE, (AFUNPTR)gate_count,
+                           IARG_FAST_ANALYSIS_CALL, IARG_UINT32, block->sl, IARG_END);
+          BBL_InsertThenCall(bbl, IPOINT_BEFORE, (AFUNPTR)gate_cross,
+                             IARG_THREAD_ID, IARG_END);
+          BBL_InsertIfCall(bbl, IPOINT_BEFORE, (AFUNPTR)is_recording,
+                           IARG_FAST_ANALYSIS_CALL, IARG_END);
+          BBL_InsertThenCall(bbl, IPOINT_BEFORE, (AFUNPTR)before_block,
+                             IARG_PTR, block,
+                             IARG_THREAD_ID,
+                             IARG_END);
+       }
+       else {
+          BBL_InsertCall(bbl, IPOINT_BEFORE, (AFUNPTR)before_block,
+                         IARG_PTR, block,
+                         IARG_THREAD_ID,
+                         IARG_END);
+       }
    }
 }
 
 KNOB<string> KnobOutputFile(KNOB_MODE_WRITEONCE, "pintool",
    "o", "streamcount.bin", "specify output file name");
 
-//This function is called when the application exits
-VOID Fini(INT32 code, VOID *v)
-{
-   //FIXME: hacky way of making sure the last stream gets tidied up
-   branch_taken(0);
+KNOB<string> KnobTimelineFile(KNOB_MODE_WRITEONCE, "pintool",
+   "t", "timeline.bin", "specify timeline output file name");
 
-   //Write to a file since cout and cerr maybe closed by the application
-   ofstream OutFile,TimelineFile;
-   OutFile.open(KnobOutputFile.Value().c_str(),ofstream::binary);
-   TimelineFile.open("timeline.bin",ofstream::binary);
+//stop the timeline writer; called without the VM lock so it can wait for the thread
+VOID FiniUnlocked(INT32 code, VOID *v)
+{
+   timeline_writer_stop = true;
+   PIN_SemaphoreSet(&timeline_ready);
+   PIN_WaitForThreadTermination(timeline_writer_uid,PIN_INFINITE_TIMEOUT,NULL);
+}
 
+//write what each stream accessed to the -m file
+static VOID write_memory_file()
+{
+   ofstream MemoryFile;
+   MemoryFile.open(KnobMemoryFile.Value().c_str(),ofstream::binary);
+   UINT32 records = 0;
+   for(UINT32 i=0;i<stream_memory_table.size();++i) {
+      if(stream_memory_table[i] != NULL) records++;
+   }
+   UINT32 header[5] = { MEMORY_MAGIC, MEMORY_VERSION, MEMORY_PAGE_SHIFT, MEMORY_LINE_SHIFT, records };
+   MemoryFile.write(reinterpret_cast <const char*>(header),sizeof(header));
 
-   int call_order_size = stream_call_order.size();
-   TimelineFile.write((char*)&call_order_size,sizeof(call_order_size));
-   for(UINT32 i=0;i<stream_call_order.size();++i) {
-      UINT32 call = stream_call_order[i];
-      TimelineFile.write((char*)&call,sizeof(UINT32));
+   for(UINT32 i=0;i<stream_memory_table.size();++i) {
+      const stream_memory* m = stream_memory_table[i];
+      if(m == NULL) continue;
+      memory_stream_header h;
+      h.id = i;
+      h.npages = m->pages.size();
+      h.nlines = m->lines.size();
+      h.reserved = 0;
+      h.reads = m->reads;
+      h.writes = m->writes;
+      memcpy(h.strides,m->strides,sizeof(h.strides));
+      MemoryFile.write(reinterpret_cast <const char*>(&h),sizeof(h));
+      const std::tr1::unordered_map<UINT64,UINT64>* histograms[2] = { &m->pages, &m->lines };
+      for(UINT32 j=0;j<2;++j) {
+         std::tr1::unordered_map<UINT64,UINT64>::const_iterator it;
+         for(it=histograms[j]->begin();it!=histograms[j]->end();++it) {
+            UINT64 pair[2] = { it->first, it->second };
+            MemoryFile.write(reinterpret_cast <const char*>(pair),sizeof(pair));
+         }
+      }
    }
+   MemoryFile.close();
+}
 
+//This function is called when the application exits
+VOID Fini(INT32 code, VOID *v)
+{
+   //merge threads that are still running when the application exits
+   THREADID tid = PIN_ThreadId();
+   while(!thread_states.empty()) {
+      retire_thread(thread_states.back(),tid);
+   }
    TimelineFile.close();
 
-   //write global stats
-   int table_size = stream_table.size();
-   OutFile.write(reinterpret_cast <const char*>(&(table_size)),sizeof(int));
-   //write streams
-   vector<stream_table_entry*>::iterator it;
-   for(UINT32 i=0;i<stream_table.size();++i) {
-       stream_table_entry* entry = stream_table[i];
-       OutFile.write(reinterpret_cast <const char*>(&(entry->sl)),sizeof(UINT32));
-       OutFile.write(reinterpret_cast <const char*>(&(entry->insvalues.at(0))),sizeof(int)*entry->sl);
-       OutFile.write(reinterpret_cast <const char*>(&(entry->lscount)),sizeof(UINT32));
-       OutFile.write(reinterpret_cast <const char*>(&(entry->scount)),sizeof(UINT32));
-       const char* img_name = img_name_list[entry->img].c_str();
-       UINT32 img_name_size = img_name_list[entry->img].size()+1;
-       const char* rtn_name = rtn_name_list[entry->rtn].c_str();
-       UINT32 rtn_name_size = rtn_name_list[entry->rtn].size()+1;
-       OutFile.write(reinterpret_cast <const char*>(&(img_name_size)),sizeof(UINT32));
-       OutFile.write(img_name,img_name_size);
-       OutFile.write(reinterpret_cast <const char*>(&(rtn_name_size)),sizeof(UINT32));
-       OutFile.write(rtn_name,rtn_name_size);
-       int next_stream_size = entry->next_stream.size();
-       OutFile.write(reinterpret_cast <const char*>(&(next_stream_size)),sizeof(int));
-       for(map<UINT32,UINT32>::iterator it=entry->next_stream.begin();it!=entry->next_stream.end();++it) {
-           OutFile.write(reinterpret_cast <const char*>(&(it->first)),sizeof(int));
-           OutFile.write(reinterpret_cast <const char*>(&(it->second)),sizeof(int));
-       }
+   //the writer thread has stopped: publish what is left and say the target is done
+   if(live_ring) {
+      GetLock(&timeline_lock,tid+1);
+      publish_live(tid);
+      live_ring->push(LIVE_END,"",0);
+      ReleaseLock(&timeline_lock);
    }
+
+   //count mode keeps no per-thread totals; derive them from the block counts
+   if(count_mode) stream_table.totals_from_counts();
+
+   //Write to a file since cout and cerr maybe closed by the application
+   ofstream OutFile;
+   OutFile.open(KnobOutputFile.Value().c_str(),ofstream::binary);
+   streamcount_sampling sampling;
+   sampling.sample_on = KnobSamplePeriod.Value() > 0 ? KnobSampleOn.Value() : 0;
+   sampling.sample_period = KnobSamplePeriod.Value();
+   sampling.start_icount = KnobStartIcount.Value();
+   sampling.stop_icount = KnobStopIcount.Value();
+   sampling.total_icount = gating ? gate_icount : stream_table.numIrefs;
+   sampling.recorded_icount = stream_table.numIrefs;
+   stream_table.write(OutFile,count_mode ? STREAMCOUNT_MODE_COUNT : STREAMCOUNT_MODE_STREAM,sampling,
+                      KnobStartRtn.Value(),KnobStopRtn.Value(),img_names,rtn_names);
    OutFile.close();
 
+   if(memory_tracing) write_memory_file();
+   if(EventsTemp.is_open()) write_events_file();
+
    ofstream DebugFile;
    DebugFile.open("debug.txt");
-   //write global stats
-   DebugFile << "numStreamS: " << stream_table.size() << endl;
-   DebugFile << "numStreamD: " << numStreamD << endl;
-   DebugFile << "numMemRef: "  << numMemRef << endl;
-   DebugFile << "numIrefs: " << numIrefs << endl;
-   DebugFile << "maxStreamLen: " << maxStreamLen << endl;
-   DebugFile << "avgStreamLen: " << (double)numIrefs/numStreamD << endl;
-
-   //write streams
-   for(UINT32 i=0;i<stream_table.size();++i) {
-       stream_table_entry* entry = stream_table[i];
-
-       DebugFile << i << ": (0x" << hex << entry->sa << ", " << dec <<
-               entry->sl << ", " << entry->lscount << "), "
-               << "(" << entry->scount << "); " ;
-
-       DebugFile << "{ ";
-       for(map<UINT32,UINT32>::iterator it=entry->next_stream.begin();it!=entry->next_stream.end();++it) {
-           DebugFile << "(" << it->first << "," << it->second << ")";
-       }
-       DebugFile << " }" << endl;
-   }
+   stream_table.write_debug(DebugFile);
    DebugFile.close();
-
 }
 
 /* =====================================================================
@@ -286,12 +1022,91 @@ int main(int argc, char * argv[])
    //Initialize pin
    if (PIN_Init(argc, argv)) return Usage();
 
+   if(KnobMode.Value() == "count") {
+      count_mode = true;
+   }
+   else if(KnobMode.Value() != "stream") {
+      cerr << "streamcount: unknown -mode " << KnobMode.Value() << endl;
+      return Usage();
+   }
+   if(count_mode && !KnobEventsFile.Value().empty()) {
+      cerr << "streamcount: -events needs -mode stream" << endl;
+      return Usage();
+   }
+
+   //-memory needs a trace buffer and, in stream mode, a register for the stream ordinal
+   memory_tracing = KnobMemory.Value();
+   if(memory_tracing) {
+      InitLock(&memory_lock);
+      memory_buffer = PIN_DefineTraceBuffer(sizeof(mem_ref), MEMORY_BUFFER_PAGES,
+                                            memory_buffer_full, 0);
+      ordinal_reg = PIN_ClaimToolRegister();
+      if(memory_buffer == BUFFER_ID_INVALID || ordinal_reg == REG_INVALID()) {
+         cerr << "streamcount: could not set up -memory tracing" << endl;
+         return 1;
+      }
+   }
+
+   //Set up the recording gate if only part of the run is to be recorded
+   gating = KnobStartIcount.Value() > 0 || KnobStopIcount.Value() > 0 ||
+            !KnobStartRtn.Value().empty() || !KnobStopRtn.Value().empty() ||
+            KnobSamplePeriod.Value() > 0;
+   if(KnobSamplePeriod.Value() > 0 && KnobSampleOn.Value() == 0) {
+      cerr << "streamcount: -sample_period needs -sample_on" << endl;
+      return Usage();
+   }
+   InitLock(&gate_lock);
+   rtn_started = KnobStartRtn.Value().empty();
+   update_gate();
+
    //Register Instruction to be called to instrument instructions
+   IMG_AddInstrumentFunction(ImageLoad, 0);
    TRACE_AddInstrumentFunction(Trace, 0);
 
    //Register Fini to be called when the application exits
+   InitLock(&names_lock);
    PIN_AddFiniFunction(Fini, 0);
 
+   //count mode needs neither per-thread state nor the timeline
+   if(!count_mode) {
+      //Per-thread stream state lives in TLS
+      thread_key = PIN_CreateThreadDataKey(0);
+      PIN_AddThreadStartFunction(ThreadStart, 0);
+      PIN_AddThreadFiniFunction(ThreadFini, 0);
+
+      //Open the timeline now so it can be streamed out while the target runs
+      TimelineFile.open(KnobTimelineFile.Value().c_str(),ofstream::binary);
+      UINT32 timeline_header[2] = { TIMELINE_MAGIC, TIMELINE_VERSION };
+      TimelineFile.write(reinterpret_cast <const char*>(timeline_header),sizeof(timeline_header));
+      TimelineFile.flush();
+
+      //events are spooled here until Fini writes the event file
+      if(!KnobEventsFile.Value().empty()) {
+         EventsTemp.open((KnobEventsFile.Value()+".tmp").c_str(),ofstream::binary);
+         events_recording = true;
+      }
+   }
+
+   if(!KnobLive.Value().empty()) {
+      live_ring = ShmRing::create(KnobLive.Value().c_str(),KnobLiveSize.Value());
+      if(live_ring == NULL) {
+         cerr << "streamcount: could not create the -live ring " << KnobLive.Value() << endl;
+         return 1;
+      }
+   }
+
+   //the writer thread streams out the timeline and -live updates
+   if(!count_mode || live_ring != NULL) {
+      InitLock(&timeline_lock);
+      PIN_SemaphoreInit(&timeline_ready);
+      PIN_AddFiniUnlockedFunction(FiniUnlocked, 0);
+      if(PIN_SpawnInternalThread(timeline_writer, 0, 0, &timeline_writer_uid) == INVALID_THREADID) {
+         cerr << "streamcount: could not start the timeline writer thread" << endl;
+         return 1;
+      }
+      timeline_writer_running = true;
+   }
+
    //Start the program, never returns
    PIN_StartProgram();
 
@@ -0,0 +1,51 @@
+#ifndef STREAMCOUNT_FORMAT_H
+#define STREAMCOUNT_FORMAT_H
+
+#include <stdint.h>
+
+//streamcount.bin layouts from before the pv format (pvformat.h), read by
+//pvconvert; the mode and sampling types are shared with the pv format
+//
+//legacy:    INT32 stream count, then the stream records; in the earliest
+//           files (the bundled *_streamcount.bin) each record starts with
+//           the UINT32 stream address
+//versioned: UINT32 STREAMCOUNT_MAGIC, UINT32 version, (version 3 and up)
+//           UINT32 streamcount_mode, a streamcount_sampling block followed
+//           by the start and stop routine names (each a UINT32 size
+//           including the terminating NUL, then the bytes), then INT32
+//           stream count and the stream records
+//
+//stream record: UINT32 sl, sl INT32 Insvals, UINT32 lscount, scount,
+//               img and rtn names (size-prefixed as above), INT32 successor
+//               count, then <UINT32 stream index,times> pairs
+//
+//scount and times are UINT64 from version 3 on, UINT32 before
+
+#define STREAMCOUNT_MAGIC 0xffffffffu //never a valid legacy stream count
+#define STREAMCOUNT_VERSION 3
+#define STREAMCOUNT_VERSION_COUNT64 3 //first version with 64-bit counts and a mode
+
+//what a stream record describes
+enum streamcount_mode {
+   STREAMCOUNT_MODE_STREAM, //instructions run between taken branches, with successors
+   STREAMCOUNT_MODE_COUNT //single basic blocks with execution counts only
+};
+
+//which part of the run the counts cover
+typedef struct {
+   uint64_t sample_on; //instructions recorded out of every sample_period, 0 if not sampling
+   uint64_t sample_period;
+   uint64_t start_icount; //recording started after this many instructions
+   uint64_t stop_icount; //recording stopped after this many instructions, 0 if never
+   uint64_t total_icount; //instructions the target executed, 0 if not counted
+   uint64_t recorded_icount; //instructions executed while recording
+} streamcount_sampling;
+
+//factor that scales recorded counts to estimates for the whole window
+inline double sampling_scale(const streamcount_sampling& s)
+{
+   if(s.sample_on == 0 || s.sample_period == 0) return 1.0;
+   return (double)s.sample_period/s.sample_on;
+}
+
+#endif
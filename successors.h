@@ -0,0 +1,187 @@
+#ifndef SUCCESSORS_H
+#define SUCCESSORS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+//<stream index,times executed>
+typedef struct {
+   uint32_t id;
+   uint64_t count; //0 marks an unused slot
+} successor;
+
+//Transition counts from one stream to the streams executed right after it.
+//Most streams have one or two successors, so those are stored inline; a
+//stream with more (indirect jumps, returns) is promoted to an open-addressing
+//table. Either way a transition is a single add().
+class SuccessorList
+{
+public:
+   static const uint32_t INLINE_SUCCESSORS = 2;
+
+   SuccessorList() : table(NULL), capacity(0), n(0)
+   {
+      for(uint32_t i=0;i<INLINE_SUCCESSORS;++i) {
+         inline_slots[i].id = 0;
+         inline_slots[i].count = 0;
+      }
+   }
+
+   SuccessorList(const SuccessorList& other) : table(NULL), capacity(0), n(0)
+   {
+      copy(other);
+   }
+
+   SuccessorList& operator=(const SuccessorList& other)
+   {
+      if(this != &other) {
+         delete[] table;
+         table = NULL;
+         capacity = 0;
+         n = 0;
+         copy(other);
+      }
+      return *this;
+   }
+
+   ~SuccessorList() { delete[] table; }
+
+   //count another times transitions to stream id
+   void add(uint32_t id, uint64_t times = 1)
+   {
+      if(times == 0) return;
+      if(table == NULL) {
+         for(uint32_t i=0;i<n;++i) {
+            if(inline_slots[i].id == id) {
+               inline_slots[i].count += times;
+               return;
+            }
+         }
+         if(n < INLINE_SUCCESSORS) {
+            inline_slots[n].id = id;
+            inline_slots[n].count = times;
+            n++;
+            return;
+         }
+         promote();
+      }
+      else if((n+1)*2 > capacity) {
+         grow();
+      }
+      if(insert(table,capacity,id,times)) n++;
+   }
+
+   //number of distinct successors
+   uint32_t size() const { return n; }
+
+   //bytes allocated outside the object, for a promoted list
+   size_t heap_bytes() const { return table == NULL ? 0 : capacity*sizeof(successor); }
+
+   //times id was executed after this stream
+   uint64_t count(uint32_t id) const
+   {
+      for(const_iterator it=begin();it!=end();++it) {
+         if(it->id == id) return it->count;
+      }
+      return 0;
+   }
+
+   //visits every used slot, in no particular order
+   class const_iterator
+   {
+   public:
+      const_iterator(const successor* p, const successor* last) : p(p), last(last) { skip(); }
+      const successor& operator*() const { return *p; }
+      const successor* operator->() const { return p; }
+      const_iterator& operator++() { ++p; skip(); return *this; }
+      bool operator==(const const_iterator& other) const { return p == other.p; }
+      bool operator!=(const const_iterator& other) const { return p != other.p; }
+   private:
+      void skip() { while(p != last && p->count == 0) ++p; }
+      const successor* p;
+      const successor* last;
+   };
+
+   const_iterator begin() const
+   {
+      if(table == NULL) return const_iterator(inline_slots,inline_slots+n);
+      return const_iterator(table,table+capacity);
+   }
+
+   const_iterator end() const
+   {
+      if(table == NULL) return const_iterator(inline_slots+n,inline_slots+n);
+      return const_iterator(table+capacity,table+capacity);
+   }
+
+private:
+   successor inline_slots[INLINE_SUCCESSORS];
+   successor* table; //NULL until promoted
+   uint32_t capacity; //power of two
+   uint32_t n;
+
+   static uint32_t slot_of(uint32_t id, uint32_t capacity)
+   {
+      return (id * 2654435761u) & (capacity-1);
+   }
+
+   //add to an existing slot for id or claim an empty one
+   static bool insert(successor* slots, uint32_t size, uint32_t id, uint64_t times)
+   {
+      uint32_t i = slot_of(id,size);
+      while(slots[i].count != 0) {
+         if(slots[i].id == id) {
+            slots[i].count += times;
+            return false;
+         }
+         i = (i+1) & (size-1);
+      }
+      slots[i].id = id;
+      slots[i].count = times;
+      return true;
+   }
+
+   static successor* allocate(uint32_t size)
+   {
+      successor* slots = new successor[size];
+      for(uint32_t i=0;i<size;++i) {
+         slots[i].id = 0;
+         slots[i].count = 0;
+      }
+      return slots;
+   }
+
+   void promote()
+   {
+      capacity = 8;
+      table = allocate(capacity);
+      for(uint32_t i=0;i<n;++i) {
+         insert(table,capacity,inline_slots[i].id,inline_slots[i].count);
+      }
+   }
+
+   void grow()
+   {
+      successor* old = table;
+      uint32_t old_capacity = capacity;
+      capacity *= 2;
+      table = allocate(capacity);
+      for(uint32_t i=0;i<old_capacity;++i) {
+         if(old[i].count != 0) insert(table,capacity,old[i].id,old[i].count);
+      }
+      delete[] old;
+   }
+
+   void copy(const SuccessorList& other)
+   {
+      for(uint32_t i=0;i<INLINE_SUCCESSORS;++i) inline_slots[i] = other.inline_slots[i];
+      n = other.n;
+      if(other.table != NULL) {
+         capacity = other.capacity;
+         table = allocate(capacity);
+         for(uint32_t i=0;i<capacity;++i) table[i] = other.table[i];
+      }
+   }
+};
+
+#endif
@@ -1,9 +1,653 @@
 #include "gtest/gtest.h"
 
+#include "successors.h"
+#include "name_table.h"
+#include "memory_format.h"
+#include "shm_ring.h"
+#include "stream_builder.h"
+#include "pvformat.h"
+#include "timeline_format.h"
+#include "timeline_reader.h"
+#include "parallel.h"
+#include "instance_grid.h"
+#include "filter.h"
+#include "lod.h"
+#include "transitions.h"
+#include "force_layout.h"
+
+#include <stdio.h>
+#include <fstream>
+#include <unistd.h>
+
 TEST(ExampleTest1, ExampleTest) {
   EXPECT_EQ(1, 1);
 }
 
+TEST(SuccessorListTest, InlineSuccessors) {
+  SuccessorList s;
+  s.add(7);
+  s.add(7);
+  s.add(3, 5);
+  EXPECT_EQ(2u, s.size());
+  EXPECT_EQ(2u, s.count(7));
+  EXPECT_EQ(5u, s.count(3));
+  EXPECT_EQ(0u, s.count(1));
+}
+
+TEST(SuccessorListTest, PromotesForHighFanOut) {
+  SuccessorList s;
+  for (uint32_t i = 0; i < 100; ++i) {
+    s.add(i, i + 1);
+    s.add(i);
+  }
+  EXPECT_EQ(100u, s.size());
+  uint32_t visited = 0;
+  uint64_t total = 0;
+  for (SuccessorList::const_iterator it = s.begin(); it != s.end(); ++it) {
+    EXPECT_EQ(it->id + 2, it->count);
+    visited++;
+    total += it->count;
+  }
+  EXPECT_EQ(100u, visited);
+  EXPECT_EQ(100u * 101 / 2 + 100, total);
+}
+
+TEST(SuccessorListTest, CopiesAreIndependent) {
+  SuccessorList a;
+  for (uint32_t i = 0; i < 10; ++i) a.add(i);
+  SuccessorList b(a);
+  b.add(0);
+  SuccessorList c;
+  c = b;
+  c.add(0);
+  EXPECT_EQ(1u, a.count(0));
+  EXPECT_EQ(2u, b.count(0));
+  EXPECT_EQ(3u, c.count(0));
+  EXPECT_EQ(10u, c.size());
+}
+
+TEST(SuccessorListTest, CountsPast32Bits) {
+  SuccessorList s;
+  s.add(1, 0xffffffffu);
+  s.add(1, 2);
+  for (uint32_t i = 2; i < 10; ++i) s.add(i);
+  s.add(1);
+  EXPECT_EQ(0x100000002ull, s.count(1));
+}
+
+TEST(NameTableTest, InternsEachNameOnce) {
+  NameTable names;
+  EXPECT_EQ(0u, names.intern("/bin/ls"));
+  EXPECT_EQ(1u, names.intern("main"));
+  EXPECT_EQ(0u, names.intern("/bin/ls"));
+  EXPECT_EQ(2u, names.size());
+  EXPECT_EQ("main", names.name(1));
+}
+
+TEST(MemoryFormatTest, StrideBuckets) {
+  EXPECT_EQ(0u, stride_bucket(0x1000, 0x1000));
+  EXPECT_EQ(1u, stride_bucket(0x1000, 0x1001));
+  EXPECT_EQ(4u, stride_bucket(0x1008, 0x1000));
+  EXPECT_EQ(7u, stride_bucket(0x1000, 0x1040));
+  EXPECT_EQ(MEMORY_STRIDE_BUCKETS - 1, stride_bucket(0, 1ull << 40));
+}
+
+static std::string ring_path() {
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/test_pinvis_ring.%d", (int)getpid());
+  return path;
+}
+
+TEST(ShmRingTest, MessagesWrapInOrder) {
+  ShmRing* producer = ShmRing::create(ring_path().c_str(), 256);
+  ASSERT_TRUE(producer != NULL);
+  ShmRing* consumer = ShmRing::attach(ring_path().c_str());
+  ASSERT_TRUE(consumer != NULL);
+  uint32_t next = 0;
+  for (uint32_t i = 0; i < 100; ++i) {
+    uint32_t payload[5] = { i, i, i, i, i };
+    ASSERT_TRUE(producer->push(1 + i % 3, payload, 4 + 4 * (i % 5)));
+    uint32_t type, size;
+    const void* p;
+    while (consumer->peek(&type, &p, &size)) {
+      EXPECT_EQ(1 + next % 3, type);
+      EXPECT_EQ(4 + 4 * (next % 5), size);
+      EXPECT_EQ(next, *static_cast<const uint32_t*>(p));
+      consumer->pop();
+      next++;
+    }
+  }
+  EXPECT_EQ(100u, next);
+  EXPECT_EQ(0u, consumer->pending());
+  delete consumer;
+  delete producer;
+  unlink(ring_path().c_str());
+}
+
+TEST(ShmRingTest, FullRingRefusesWithoutBlocking) {
+  ShmRing* ring = ShmRing::create(ring_path().c_str(), 128);
+  ASSERT_TRUE(ring != NULL);
+  char payload[56] = { 0 };
+  EXPECT_TRUE(ring->push(1, payload, sizeof(payload)));
+  EXPECT_TRUE(ring->push(1, payload, sizeof(payload)));
+  EXPECT_FALSE(ring->push(1, payload, sizeof(payload)));
+  ring->drop(sizeof(payload));
+  EXPECT_EQ(1u, ring->dropped());
+
+  uint32_t type, size;
+  const void* p;
+  ASSERT_TRUE(ring->peek(&type, &p, &size));
+  ring->pop();
+  EXPECT_TRUE(ring->push(1, payload, sizeof(payload)));
+  delete ring;
+  unlink(ring_path().c_str());
+}
+
+TEST(StreamBuilderTest, FormsStreamsAcrossBlocks) {
+  StreamTable<NullLock> table;
+  block_info* a = table.new_block(0x1000, 1, 0, 0);
+  block_info* b = table.new_block(0x1004, 2, 0, 0);
+  b->insvalues[1] = INS_READ;
+  b->lscount = 1;
+  branch_site* site = table.new_site();
+
+  StreamThread thread;
+  for (int i = 0; i < 2; ++i) {
+    thread.block(a);
+    thread.block(b);
+    EXPECT_EQ(0u, thread.branch(&table, site));
+  }
+  EXPECT_EQ(StreamThread::NO_STREAM, thread.branch(&table, site));
+  table.merge(thread, 0);
+
+  ASSERT_EQ(1u, table.size());
+  stream_table_entry* e = table.entry(0);
+  EXPECT_EQ(0x1000u, e->sa);
+  EXPECT_EQ(3u, e->sl);
+  EXPECT_EQ(1u, e->lscount);
+  EXPECT_EQ(INS_READ, e->insvalues[2]);
+  EXPECT_EQ(2u, e->scount);
+  EXPECT_EQ(1u, e->next_stream.count(0));
+  EXPECT_EQ(2u, table.numStreamD);
+  EXPECT_EQ(6u, table.numIrefs);
+}
+
+TEST(PvFormatTest, MapsWhatWasWritten) {
+  streamcount_sampling sampling;
+  memset(&sampling, 0, sizeof(sampling));
+  sampling.total_icount = 7;
+  PvWriter writer(STREAMCOUNT_MODE_STREAM, sampling);
+  writer.start_rtn = writer.string("main");
+  int a[3] = { INS_NORMAL, INS_WRITE, INS_READ };
+  int b[5] = { INS_READ, INS_READ, INS_NORMAL, INS_NORMAL, INS_WRITE };
+  writer.stream(0x1000, 3, a, 2, 10, writer.string("/bin/ls"), writer.string("main"));
+  writer.edge(1, 4);
+  writer.edge(0, 6);
+  writer.stream(0x2000, 5, b, 3, 1ull << 40, writer.string("/bin/ls"), writer.string("helper"));
+  std::string path = ring_path() + ".pv";
+  {
+    std::ofstream out(path.c_str(), std::ios::binary);
+    writer.write(out);
+  }
+
+  ASSERT_TRUE(PvFile::is_pv(path.c_str()));
+  PvFile* file = PvFile::open(path.c_str());
+  ASSERT_TRUE(file != NULL);
+  EXPECT_EQ(2u, file->streams());
+  EXPECT_EQ(7u, file->header().sampling.total_icount);
+  EXPECT_STREQ("main", file->string(file->header().start_rtn));
+  EXPECT_STREQ("", file->string(file->header().stop_rtn));
+  const pv_stream& s = file->stream(1);
+  EXPECT_EQ(0x2000u, s.sa);
+  EXPECT_EQ(1ull << 40, s.scount);
+  EXPECT_STREQ("/bin/ls", file->string(s.img));
+  EXPECT_STREQ("helper", file->string(s.rtn));
+  for (int i = 0; i < 5; ++i) {
+    EXPECT_EQ(b[i], pv_insval(file->insvals(), s.insval_first + i));
+  }
+  uint64_t n;
+  const pv_edge* edges = file->edges(0, &n);
+  ASSERT_EQ(2u, n);
+  EXPECT_EQ(1u, edges[0].id);
+  EXPECT_EQ(6u, edges[1].count);
+  file->edges(1, &n);
+  EXPECT_EQ(0u, n);
+  delete file;
+
+  //a truncated file is refused rather than read past its end
+  ASSERT_EQ(0, truncate(path.c_str(), sizeof(pv_header) + 8));
+  EXPECT_TRUE(PvFile::open(path.c_str()) == NULL);
+  unlink(path.c_str());
+}
+
+TEST(TimelineTest, LoopsPackSmallAndDecodeExactly) {
+  std::vector<uint32_t> ids;
+  for (uint32_t i = 0; i < 1000; ++i) {
+    ids.push_back(7);
+    ids.push_back(8);
+    ids.push_back(3000000000u);
+  }
+  for (uint32_t i = 0; i < 100; ++i) ids.push_back(i * 7919 % 1000);
+  for (uint32_t i = 0; i < 50; ++i) ids.push_back(42);
+
+  TimelineEncoder encoder;
+  std::vector<uint8_t> packed;
+  encoder.encode(&ids[0], ids.size(), &packed);
+  EXPECT_LT(packed.size(), 400u);
+  std::vector<uint32_t> decoded(ids.size());
+  ASSERT_TRUE(timeline_decode(&packed[0], packed.size(), &decoded[0], decoded.size()));
+  EXPECT_TRUE(decoded == ids);
+  EXPECT_FALSE(timeline_decode(&packed[0], packed.size() - 1, &decoded[0], decoded.size()));
+}
+
+TEST(TimelineTest, ReaderSeeksAcrossPackedChunks) {
+  std::string path = ring_path() + ".timeline";
+  {
+    std::ofstream out(path.c_str(), std::ios::binary);
+    uint32_t header[2] = { TIMELINE_MAGIC, TIMELINE_VERSION };
+    out.write((const char*)header, sizeof(header));
+    TimelineEncoder encoder;
+    std::vector<uint8_t> packed;
+    for (uint32_t c = 0; c < 4; ++c) {
+      std::vector<uint32_t> calls(1000);
+      for (uint32_t i = 0; i < calls.size(); ++i) calls[i] = (c * 1000 + i) / 10;
+      encoder.encode(&calls[0], calls.size(), &packed);
+      timeline_packed_header h = { c % 2, (uint32_t)calls.size(), (uint32_t)packed.size(), 0 };
+      out.write((const char*)&h, sizeof(h));
+      out.write((const char*)&packed[0], packed.size());
+    }
+    //a chunk cut off by an abnormal exit is ignored
+    timeline_packed_header h = { 0, 1000, 500, 0 };
+    out.write((const char*)&h, sizeof(h));
+  }
+
+  TimelineReader reader;
+  ASSERT_TRUE(reader.open(path.c_str()));
+  ASSERT_EQ(2u, reader.threads());
+  EXPECT_EQ(1u, reader.tid(1));
+  EXPECT_EQ(2000u, reader.calls(0));
+  EXPECT_EQ(299u, reader.call(0, 1999));
+  EXPECT_EQ(0u, reader.call(0, 0));
+  EXPECT_EQ(1u, reader.call(0, 10));
+  EXPECT_EQ(100u, reader.call(1, 0));
+  EXPECT_EQ(3u, reader.decoded());
+  unlink(path.c_str());
+}
+
+class EvenStreams {
+ public:
+  bool operator()(uint32_t id) const { return id % 2 == 0; }
+};
+
+class NoStreams {
+ public:
+  bool operator()(uint32_t) const { return false; }
+};
+
+TEST(TimelineTest, VisibleCallsSkipHiddenStreamsAndExtend) {
+  TimelineReader reader;
+  std::vector<uint32_t> calls;
+  for (uint32_t i = 0; i < 100; ++i) calls.push_back(i % 7);
+  reader.append(5, &calls[0], calls.size());
+
+  VisibleCalls visible;
+  visible.extend(reader, 0, EvenStreams());
+  uint64_t expected = 0;
+  for (uint32_t i = 0; i < calls.size(); ++i) {
+    if (calls[i] % 2) continue;
+    ASSERT_LT(expected, visible.size());
+    EXPECT_EQ(i, visible.call(expected)) << expected;
+    expected++;
+  }
+  EXPECT_EQ(expected, visible.size());
+  //call 1 is stream 1, hidden; the next shown one is call 2
+  EXPECT_EQ(1u, visible.find(1));
+  EXPECT_EQ(visible.size(), visible.find(100));
+
+  //appended calls are indexed without rescanning the others
+  reader.append(5, &calls[0], 7);
+  visible.extend(reader, 0, EvenStreams());
+  EXPECT_EQ(107u, visible.calls_indexed());
+  EXPECT_EQ(expected + 4, visible.size());
+  EXPECT_EQ(106u, visible.call(visible.size() - 1));
+
+  visible.clear();
+  visible.extend(reader, 0, NoStreams());
+  EXPECT_EQ(0u, visible.size());
+}
+
+TEST(TimelineTest, StepsResumeWhereReindexingLeftOff) {
+  TimelineReader reader;
+  std::vector<uint32_t> calls;
+  for (uint32_t i = 0; i < 20; ++i) calls.push_back(i % 7);
+  reader.append(5, &calls[0], calls.size());
+  VisibleCalls visible;
+  visible.extend(reader, 0, EvenStreams());
+  //shown calls: 0 2 4 6 7 9 11 13 14 16 18
+  ASSERT_EQ(11u, visible.size());
+  EXPECT_EQ(0, visible.step(-1, false, 1));
+  EXPECT_EQ(10, visible.step(-1, false, -1));
+  EXPECT_EQ(0, visible.step(10, false, 1));
+
+  //reindexed at a shown call: n and p move off it
+  bool between = true;
+  int64_t k = visible.locate(9, &between);
+  EXPECT_FALSE(between);
+  EXPECT_EQ(9u, visible.call(k));
+  EXPECT_EQ(11u, visible.call(visible.step(k, between, 1)));
+  EXPECT_EQ(7u, visible.call(visible.step(k, between, -1)));
+
+  //reindexed at a hidden call: n and p go to the shown calls around it
+  k = visible.locate(10, &between);
+  EXPECT_TRUE(between);
+  EXPECT_EQ(11u, visible.call(visible.step(k, between, 1)));
+  EXPECT_EQ(9u, visible.call(visible.step(k, between, -1)));
+  EXPECT_EQ(13u, visible.call(visible.step(k, between, 2)));
+
+  //past the last shown call
+  k = visible.locate(19, &between);
+  EXPECT_TRUE(between);
+  EXPECT_EQ(0u, visible.call(visible.step(k, between, 1)));
+  EXPECT_EQ(18u, visible.call(visible.step(k, between, -1)));
+}
+
+class SumTask {
+ public:
+  SumTask() : sum(0), calls(0) {}
+  void run(uint64_t begin, uint64_t end) {
+    for (uint64_t i = begin; i < end; ++i) sum += i;
+    calls++;
+  }
+  uint64_t sum;
+  int calls;
+};
+
+TEST(ParallelTest, SlicesCoverTheRangeOnce) {
+  std::vector<SumTask> tasks(7);
+  parallel_for(tasks, 1000);
+  uint64_t sum = 0;
+  for (size_t i = 0; i < tasks.size(); ++i) {
+    EXPECT_EQ(1, tasks[i].calls);
+    sum += tasks[i].sum;
+  }
+  EXPECT_EQ(999u * 1000 / 2, sum);
+}
+
+struct EveryOther {
+  bool operator()(uint32_t i) const { return i % 2 == 0; }
+};
+
+TEST(InstanceGridTest, PicksTheNearestBoxLikeBruteForce) {
+  //columns of boxes as in the grid layout, plus a few off the integer grid
+  std::vector<float> corners;
+  for (int x = -10; x < 10; ++x)
+    for (int z = -10; z < 10; ++z)
+      for (int y = 0; y < (x * 7 + z * 3 + 40) % 5 + 1; ++y) {
+        float c[4] = { (float)x, (float)-y, (float)z, 0 };
+        corners.insert(corners.end(), c, c + 4);
+      }
+  for (int i = 0; i < 10; ++i) {
+    float c[4] = { i * 1.37f - 5, 0.5f, i * -0.91f + 3, 0 };
+    corners.insert(corners.end(), c, c + 4);
+  }
+  uint32_t count = corners.size() / 4;
+  InstanceGrid grid;
+  grid.build(&corners[0], 4, count);
+  EveryOther visible;
+
+  srand(7);
+  int hits = 0;
+  for (int r = 0; r < 500; ++r) {
+    float origin[3], dir[3];
+    for (int a = 0; a < 3; ++a) {
+      origin[a] = (rand() % 1000) / 10.0f - 50;
+      float target = (rand() % 200) / 10.0f - 10;
+      dir[a] = (target - origin[a]) * 2;
+    }
+    uint32_t expected = InstanceGrid::NO_BOX;
+    float expected_t = 2;
+    for (uint32_t i = 0; i < count; ++i) {
+      float hi[3] = { corners[4 * i] + 1, corners[4 * i + 1] + 1, corners[4 * i + 2] + 1 };
+      float t, t_out;
+      if (visible(i) && InstanceGrid::segment_box(origin, dir, &corners[4 * i], hi, &t, &t_out) && t < expected_t) {
+        expected_t = t;
+        expected = i;
+      }
+    }
+    float t = 0;
+    uint32_t got = grid.pick(&corners[0], 4, origin, dir, visible, &t);
+    if (expected == InstanceGrid::NO_BOX) {
+      EXPECT_EQ(InstanceGrid::NO_BOX, got);
+      continue;
+    }
+    hits++;
+    //boxes entered at the same t are equally good
+    ASSERT_NE(InstanceGrid::NO_BOX, got);
+    EXPECT_FLOAT_EQ(expected_t, t);
+  }
+  EXPECT_GT(hits, 20);
+}
+
+TEST(FilterTest, ClausesMatchNamesAndCounts) {
+  std::vector<const char*> names;
+  names.push_back("/lib/libc.so.6");
+  names.push_back("memcpy");
+  names.push_back("/usr/bin/target");
+  names.push_back("main");
+  filter_stream libc = { 0, 1, 10, 5, 1000 };
+  filter_stream target = { 2, 3, 4, 0, 7 };
+
+  std::string error;
+  StreamFilter f;
+  ASSERT_TRUE(f.parse("img~libc rtn=memcpy scount>=1000 mem>0.4", &error)) << error;
+  f.bind(names);
+  EXPECT_TRUE(f.match(libc));
+  EXPECT_FALSE(f.match(target));
+
+  ASSERT_TRUE(f.parse("!img=\"/lib/libc.so.6\" sl<5", &error)) << error;
+  f.bind(names);
+  EXPECT_FALSE(f.match(libc));
+  EXPECT_TRUE(f.match(target));
+
+  EXPECT_FALSE(f.parse("scount~1", &error));
+  EXPECT_FALSE(f.parse("size>1", &error));
+  EXPECT_FALSE(f.parse("rtn~(", &error));
+}
+
+TEST(FilterTest, SetsComposeAndEvaluateInParallel) {
+  std::vector<const char*> names;
+  names.push_back("a");
+  names.push_back("b");
+  std::vector<filter_stream> streams(1000);
+  for (uint32_t i = 0; i < streams.size(); ++i) {
+    filter_stream s = { i % 2, i % 2, i % 13 + 1, i % 3, i };
+    streams[i] = s;
+  }
+  std::string error;
+  StreamFilter only_a, short_ones;
+  ASSERT_TRUE(only_a.parse("img=a", &error));
+  ASSERT_TRUE(short_ones.parse("sl<=3", &error));
+  FilterSet set;
+  set.push(only_a, true);
+  set.push(short_ones, false);
+  set.bind(names);
+
+  std::vector<uint64_t> bits;
+  set.evaluate(streams, &bits, 4);
+  ASSERT_EQ(16u, bits.size());
+  for (uint32_t i = 0; i < streams.size(); ++i) {
+    bool expected = i % 2 == 0 && i % 13 + 1 > 3;
+    EXPECT_EQ(expected, ((bits[i / 64] >> (i % 64)) & 1) != 0) << i;
+  }
+
+  //undoing the last filter brings its streams back
+  set.pop();
+  set.evaluate(streams, &bits, 3);
+  for (uint32_t i = 0; i < streams.size(); ++i) {
+    EXPECT_EQ(i % 2 == 0, ((bits[i / 64] >> (i % 64)) & 1) != 0) << i;
+  }
+}
+
+//cubes whose visibility is their color's alpha, as in InstancedCubes,
+//and whose draw list only changes through setVisible
+typedef struct AlphaCubes {
+  std::vector<uint8_t> alpha;
+  std::vector<bool> listed;
+  void setColor(uint32_t i) { alpha[i] = 255; }
+  void setVisible(uint32_t i, bool visible) {
+    alpha[i] = visible ? 255 : 0;
+    listed[i] = visible;
+  }
+} AlphaCubes;
+
+TEST(FilterTest, StreamsHiddenAndRecoloredAreDrawnAgain) {
+  std::vector<const char*> names;
+  names.push_back("a");
+  names.push_back("b");
+  filter_stream stream = { 1, 1, 3, 0, 10 };
+  AlphaCubes cubes;
+  cubes.alpha.assign(3, 255);
+  cubes.listed.assign(3, true);
+  bool drawn = true;
+
+  std::string error;
+  StreamFilter only_a;
+  ASSERT_TRUE(only_a.parse("img=a", &error));
+  FilterSet set;
+  set.push(only_a, true);
+  set.bind(names);
+  EXPECT_TRUE(draw_stream(&cubes, 0, 3, &drawn, set.visible(stream)));
+  EXPECT_FALSE(drawn);
+  EXPECT_FALSE(cubes.listed[0]);
+
+  //a recolor rewrites the whole texel, alpha included
+  for (uint32_t i = 0; i < 3; ++i) cubes.setColor(i);
+
+  set.clear();
+  EXPECT_TRUE(draw_stream(&cubes, 0, 3, &drawn, set.visible(stream)));
+  EXPECT_TRUE(drawn);
+  for (uint32_t i = 0; i < 3; ++i) EXPECT_TRUE(cubes.listed[i]) << i;
+  EXPECT_FALSE(draw_stream(&cubes, 0, 3, &drawn, true));
+}
+
+TEST(LodTest, TilesPlaceSumAndExpandNearTheEye) {
+  //20 tiles: a 5x5 square of tiles, one region
+  const uint64_t n = 20 * GridLod::TILE_STREAMS - 7;
+  uint32_t side = GridLod::side(n);
+  ASSERT_EQ(5u * GridLod::TILE, side);
+  std::vector<bool> used(side * side, false);
+  std::vector<lod_stream> streams(n);
+  for (uint64_t i = 0; i < n; ++i) {
+    uint32_t row, col;
+    GridLod::place(i, n, &row, &col);
+    ASSERT_LT(row, side);
+    ASSERT_LT(col, side);
+    EXPECT_FALSE(used[row * side + col]) << i;
+    used[row * side + col] = true;
+    //a tile's streams share its square
+    uint32_t t = GridLod::tile_of(i);
+    EXPECT_EQ(t % 5, row / GridLod::TILE) << i;
+    EXPECT_EQ(t / 5, col / GridLod::TILE) << i;
+    lod_stream s = { (uint32_t)(i % 4 + 1), (uint32_t)(i < 200), (uint32_t)(i % 3), i };
+    streams[i] = s;
+  }
+
+  GridLod lod;
+  lod.expand_distance = 2 * GridLod::TILE;
+  lod.build(streams, n);
+  ASSERT_EQ(20u, lod.tiles.size());
+  ASSERT_EQ(1u, lod.regions.size());
+  uint64_t instructions = 0, scount = 0;
+  for (uint64_t i = 0; i < n; ++i) {
+    instructions += streams[i].sl;
+    scount += streams[i].scount;
+  }
+  EXPECT_EQ(instructions, lod.regions[0].instructions);
+  EXPECT_EQ(scount, lod.regions[0].scount);
+  EXPECT_EQ(n, lod.regions[0].streams);
+  EXPECT_EQ(1u, lod.tiles[0].img);
+  EXPECT_EQ(0u, lod.regions[0].img);
+  //blocks grow with log2 of their instructions
+  EXPECT_NEAR(log(lod.tiles[0].instructions) / log(2.0), GridLod::depth(lod.tiles[0]), 1e-4);
+  EXPECT_GT(GridLod::depth(lod.regions[0]), GridLod::depth(lod.tiles[0]));
+
+  //far away: everything is one region block
+  std::vector<uint32_t> changed;
+  EXPECT_TRUE(lod.update(-10000, 0, -10000, &changed));
+  EXPECT_EQ(20u, changed.size());
+  EXPECT_TRUE(lod.regions[0].shown);
+  for (uint32_t t = 0; t < 20; ++t) EXPECT_FALSE(lod.tile_expanded(t));
+
+  //over tile 0: it and its neighbors expand, the far tiles are blocks
+  changed.clear();
+  EXPECT_TRUE(lod.update(8, -20, 8, &changed));
+  EXPECT_FALSE(lod.regions[0].shown);
+  EXPECT_TRUE(lod.tile_expanded(0));
+  EXPECT_FALSE(lod.tiles[0].shown);
+  EXPECT_FALSE(lod.tile_expanded(19));
+  EXPECT_TRUE(lod.tiles[19].shown);
+  for (size_t k = 0; k < changed.size(); ++k) EXPECT_TRUE(lod.tile_expanded(changed[k]));
+
+  //staying put changes nothing
+  changed.clear();
+  EXPECT_FALSE(lod.update(8, -20, 8, &changed));
+  EXPECT_TRUE(changed.empty());
+}
+
+TEST(TransitionsTest, KeepsTheMostTakenAboveTheThreshold) {
+  pv_edge edges[5] = { { 1, 0, 5 }, { 2, 0, 50 }, { 7, 0, 500 }, { 3, 0, 1 }, { 4, 0, 50 } };
+  std::vector<transition> out;
+  //stream 7 following itself is not a transition to draw
+  select_transitions(7, edges, 5, 2, 2, &out);
+  ASSERT_EQ(2u, out.size());
+  EXPECT_EQ(2u, out[0].to);
+  EXPECT_EQ(4u, out[1].to);
+  EXPECT_EQ(7u, out[0].from);
+
+  //appended after what is there, no limit
+  select_transitions(0, edges, 5, 2, 0, &out);
+  ASSERT_EQ(6u, out.size());
+  EXPECT_EQ(7u, out[2].to);
+  EXPECT_EQ(500u, out[2].count);
+  EXPECT_EQ(1u, out[5].to);
+
+  select_transitions(0, edges, 5, 1000, 0, &out);
+  EXPECT_EQ(6u, out.size());
+}
+
+TEST(ForceLayoutTest, PullsConnectedPointsTogether) {
+  //two groups of 100 on a line, each a chain, interleaved so they start mixed
+  const uint32_t n = 200;
+  std::vector<float> xy(2 * n);
+  for (uint32_t i = 0; i < n; ++i) {
+    xy[2 * i] = (float)(i % 20) * 2 - 20;
+    xy[2 * i + 1] = (float)(i / 20) * 2 - 10;
+  }
+  std::vector<force_edge> edges;
+  for (uint32_t i = 0; i + 2 < n; ++i) {
+    force_edge e = { i, i + 2, 1.0f };
+    edges.push_back(e);
+  }
+  ForceLayout layout;
+  layout.init(xy, edges);
+  while (layout.step(3)) ASSERT_LT(layout.iterations(), 1000u);
+
+  //Barnes-Hut stays close to the exact repulsion
+  float exact[2], approximate[2];
+  layout.repulsion(17, exact, approximate);
+  float error = hypotf(exact[0] - approximate[0], exact[1] - approximate[1]);
+  EXPECT_LT(error, 0.05f * hypotf(exact[0], exact[1]));
+
+  //neighbors in a chain end up nearer than points of different chains
+  const std::vector<float>& p = layout.positions();
+  double chained = 0, across = 0;
+  for (uint32_t i = 0; i + 2 < n; i += 2) {
+    chained += hypot(p[2 * i] - p[2 * (i + 2)], p[2 * i + 1] - p[2 * (i + 2) + 1]);
+    across += hypot(p[2 * i] - p[2 * (i + 1)], p[2 * i + 1] - p[2 * (i + 1) + 1]);
+  }
+  EXPECT_LT(chained * 2, across);
+}
+
 int main(int argc, char **argv) {
   testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
@@ -0,0 +1,161 @@
+#ifndef TIMELINE_FORMAT_H
+#define TIMELINE_FORMAT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <algorithm>
+
+//timeline.bin layouts, shared by streamcount (writer) and pinvis (reader)
+//
+//legacy:  INT32 call count, then one UINT32 stream index per call
+//chunked: UINT32 TIMELINE_MAGIC, UINT32 TIMELINE_VERSION, then any number of
+//         chunks, each a timeline_chunk_header followed by count UINT32
+//         stream indices. Chunks are appended while the target runs, so a
+//         file cut short by an abnormal exit is still readable up to its
+//         last complete chunk.
+//packed:  as chunked, with TIMELINE_VERSION_PACKED or later, but each chunk
+//         is a timeline_packed_header followed by bytes of tokens that
+//         timeline_decode() turns back into count stream indices. Chunks
+//         decode on their own, so a reader that indexes the chunk headers
+//         can seek to any call and decode one chunk.
+//
+//A token is a varint (7 bits per byte, low bits first) whose lowest bit
+//says what it is:
+//  0: one call; the rest is the zigzag-coded difference from the previous
+//     stream index (0 before the first call of the chunk)
+//  1: a copy; the rest is a length, and a second varint the distance back
+//     to copy from. Copies may overlap what they produce, so loops become
+//     one token and a run of one stream is a copy at distance 1.
+
+#define TIMELINE_MAGIC 0xffffffffu //never a valid legacy call count
+#define TIMELINE_VERSION 3
+#define TIMELINE_VERSION_PACKED 3 //first version with packed chunks
+#define TIMELINE_CHUNK_CALLS 65536 //calls per full chunk
+
+typedef struct {
+   uint32_t tid; //thread that made the calls
+   uint32_t count; //number of stream indices that follow
+} timeline_chunk_header;
+
+typedef struct {
+   uint32_t tid; //thread that made the calls
+   uint32_t count; //number of stream indices encoded
+   uint32_t bytes; //size of the tokens that follow
+   uint32_t reserved;
+} timeline_packed_header;
+
+#define TIMELINE_MIN_COPY 2 //shorter matches are cheaper as single calls
+
+static inline void timeline_put_varint(std::vector<uint8_t>* out, uint64_t v)
+{
+   while(v >= 0x80) {
+      out->push_back((uint8_t)(v | 0x80));
+      v >>= 7;
+   }
+   out->push_back((uint8_t)v);
+}
+
+static inline bool timeline_get_varint(const uint8_t** in, const uint8_t* end, uint64_t* v)
+{
+   *v = 0;
+   for(int shift=0;shift<64 && *in<end;shift+=7) {
+      uint8_t b = *(*in)++;
+      *v |= (uint64_t)(b & 0x7f) << shift;
+      if(!(b & 0x80)) return true;
+   }
+   return false;
+}
+
+//Encodes chunks of stream indices. A copy is looked for at the distance of
+//the previous copy (a loop body keeps its length), at the last place the
+//same two calls were seen, and at distance 1; the longest wins. Keeps its
+//hash table between chunks so it does not allocate once warm.
+class TimelineEncoder
+{
+public:
+   TimelineEncoder() : seen(1<<HASH_BITS) {}
+
+   //replaces out with the tokens for ids[0..count)
+   void encode(const uint32_t* ids, uint32_t count, std::vector<uint8_t>* out)
+   {
+      out->clear();
+      std::fill(seen.begin(),seen.end(),0);
+      uint32_t prev = 0;
+      uint32_t distance = 0;
+      uint32_t i = 0;
+      while(i < count) {
+         uint32_t best_length = 0, best_distance = 0;
+         uint32_t candidates[3] = { distance, 0, 1 };
+         if(i+1 < count) {
+            uint32_t at = seen[hash(ids[i],ids[i+1])];
+            if(at != 0 && at-1 < i) candidates[1] = i-(at-1);
+         }
+         for(int c=0;c<3;++c) {
+            uint32_t d = candidates[c];
+            if(d == 0 || d > i) continue;
+            uint32_t length = 0;
+            while(i+length < count && ids[i+length] == ids[i+length-d]) length++;
+            if(length > best_length) {
+               best_length = length;
+               best_distance = d;
+            }
+         }
+
+         if(best_length >= TIMELINE_MIN_COPY) {
+            timeline_put_varint(out,((uint64_t)best_length << 1) | 1);
+            timeline_put_varint(out,best_distance);
+            for(uint32_t j=i;j<i+best_length && j+1<count;++j) seen[hash(ids[j],ids[j+1])] = j+1;
+            distance = best_distance;
+            i += best_length;
+         }
+         else {
+            int32_t delta = (int32_t)(ids[i]-prev);
+            uint32_t zigzag = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+            timeline_put_varint(out,(uint64_t)zigzag << 1);
+            if(i+1 < count) seen[hash(ids[i],ids[i+1])] = i+1;
+            i++;
+         }
+         prev = ids[i-1];
+      }
+   }
+
+private:
+   enum { HASH_BITS = 14 };
+
+   static uint32_t hash(uint32_t a, uint32_t b)
+   {
+      return ((a*2654435761u) ^ (b*2246822519u)) >> (32-HASH_BITS);
+   }
+
+   std::vector<uint32_t> seen; //hash of two calls -> position of the first plus one, 0 if none
+};
+
+//decodes the tokens of one packed chunk into count stream indices; false if
+//they are corrupt or do not produce exactly count calls
+static inline bool timeline_decode(const uint8_t* in, size_t bytes, uint32_t* out, uint32_t count)
+{
+   const uint8_t* end = in+bytes;
+   uint32_t n = 0;
+   uint32_t prev = 0;
+   while(n < count) {
+      uint64_t v;
+      if(!timeline_get_varint(&in,end,&v)) return false;
+      if(v & 1) {
+         uint64_t length = v >> 1;
+         uint64_t distance;
+         if(!timeline_get_varint(&in,end,&distance) || distance == 0 || distance > n ||
+            length > count-n) return false;
+         for(uint64_t j=0;j<length;++j,++n) out[n] = out[n-distance];
+      }
+      else {
+         uint32_t zigzag = (uint32_t)(v >> 1);
+         int32_t delta = (int32_t)(zigzag >> 1) ^ -(int32_t)(zigzag & 1);
+         out[n++] = prev+delta;
+      }
+      prev = out[n-1];
+   }
+   return in == end;
+}
+
+#endif
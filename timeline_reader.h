@@ -0,0 +1,280 @@
+#ifndef TIMELINE_READER_H
+#define TIMELINE_READER_H
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <map>
+#include <fstream>
+
+#include "timeline_format.h"
+
+//Random access to the calls of a timeline.bin of any version without
+//loading it: open() only reads the chunk headers, and call() decodes the
+//chunk holding the call asked for, keeping the last one decoded per thread,
+//so stepping through a window touches one chunk at a time. Calls can also
+//be appended in memory (pinvis --live).
+class TimelineReader
+{
+public:
+   TimelineReader() : ndecoded(0) {}
+
+   //index the chunks of the timeline file at path; false if it cannot be read
+   bool open(const char* path)
+   {
+      file.open(path,std::ios::binary);
+      uint32_t total_calls;
+      if(!file.read((char*)&total_calls,sizeof(total_calls))) return false;
+      if(total_calls != TIMELINE_MAGIC) {
+         //legacy: one array of calls, indexed as raw chunks of the usual size
+         file.seekg(0,std::ios::end);
+         uint64_t stored = ((uint64_t)file.tellg()-sizeof(uint32_t))/sizeof(uint32_t);
+         uint64_t calls = total_calls < stored ? total_calls : stored;
+         timeline& t = timeline_of(0);
+         for(uint64_t first=0;first<calls;first+=TIMELINE_CHUNK_CALLS) {
+            uint32_t count = calls-first < TIMELINE_CHUNK_CALLS ? calls-first : TIMELINE_CHUNK_CALLS;
+            add_chunk(&t,sizeof(uint32_t)*(1+first),count,0);
+         }
+         return true;
+      }
+
+      //chunked: walk the headers until EOF or a truncated chunk
+      uint32_t version;
+      if(!file.read((char*)&version,sizeof(version))) return false;
+      file.seekg(0,std::ios::end);
+      uint64_t size = file.tellg();
+      uint64_t offset = 2*sizeof(uint32_t);
+      for(;;) {
+         file.seekg(offset);
+         uint32_t tid, count, bytes;
+         uint64_t data;
+         if(version >= TIMELINE_VERSION_PACKED) {
+            timeline_packed_header header;
+            if(!file.read((char*)&header,sizeof(header))) break;
+            tid = header.tid;
+            count = header.count;
+            bytes = header.bytes;
+            data = offset+sizeof(header);
+         }
+         else {
+            timeline_chunk_header header;
+            if(!file.read((char*)&header,sizeof(header))) break;
+            tid = header.tid;
+            count = header.count;
+            bytes = 0;
+            data = offset+sizeof(header);
+         }
+         uint64_t end = data+(bytes ? bytes : sizeof(uint32_t)*(uint64_t)count);
+         if(end > size) {
+            //keep the complete calls of a cut-off raw chunk
+            if(bytes == 0 && size > data) add_chunk(&timeline_of(tid),data,(size-data)/sizeof(uint32_t),0);
+            break;
+         }
+         add_chunk(&timeline_of(tid),data,count,bytes);
+         offset = end;
+      }
+      file.clear();
+      return true;
+   }
+
+   //append calls of thread tid, kept in memory
+   void append(uint32_t tid, const uint32_t* ids, uint32_t count)
+   {
+      timeline& t = timeline_of(tid);
+      if(t.chunks.empty() || !t.chunks.back().resident) {
+         chunk c;
+         c.first = t.calls;
+         c.offset = 0;
+         c.count = 0;
+         c.bytes = 0;
+         c.resident = true;
+         t.chunks.push_back(c);
+      }
+      chunk& c = t.chunks.back();
+      c.ids.insert(c.ids.end(),ids,ids+count);
+      c.count += count;
+      t.calls += count;
+   }
+
+   uint32_t threads() const { return timelines.size(); }
+   uint32_t tid(uint32_t t) const { return timelines[t].tid; }
+   uint64_t calls(uint32_t t) const { return timelines[t].calls; }
+
+   //stream index of call i of thread t; decodes its chunk if needed.
+   //A chunk that cannot be read reads as stream 0.
+   uint32_t call(uint32_t t, uint64_t i)
+   {
+      timeline& th = timelines[t];
+      if(th.cached != NO_CHUNK) {
+         const chunk& c = th.chunks[th.cached];
+         if(i >= c.first && i < c.first+c.count) return th.window[i-c.first];
+      }
+      //chunks are in call order: find the last one starting at or before i
+      uint32_t lo = 0, hi = th.chunks.size();
+      while(hi-lo > 1) {
+         uint32_t mid = (lo+hi)/2;
+         if(th.chunks[mid].first <= i) lo = mid;
+         else hi = mid;
+      }
+      const chunk& c = th.chunks[lo];
+      if(c.resident) return c.ids[i-c.first];
+      load(&th,lo);
+      return th.window[i-c.first];
+   }
+
+   //chunks decoded since open, to check that viewing stays local
+   uint64_t decoded() const { return ndecoded; }
+
+private:
+   enum { NO_CHUNK = 0xffffffffu };
+
+   typedef struct {
+      uint64_t first; //index of the chunk's first call in its thread
+      uint64_t offset; //file offset of the calls or tokens
+      uint32_t count;
+      uint32_t bytes; //size of the tokens; 0 if the calls are stored raw
+      bool resident; //appended in memory: the calls are in ids
+      std::vector<uint32_t> ids;
+   } chunk;
+
+   typedef struct {
+      uint32_t tid;
+      uint64_t calls;
+      std::vector<chunk> chunks;
+      uint32_t cached; //chunk whose calls are in window, NO_CHUNK if none
+      std::vector<uint32_t> window;
+   } timeline;
+
+   timeline& timeline_of(uint32_t tid)
+   {
+      std::map<uint32_t,uint32_t>::iterator it = index.find(tid);
+      if(it != index.end()) return timelines[it->second];
+      index[tid] = timelines.size();
+      timeline t;
+      t.tid = tid;
+      t.calls = 0;
+      t.cached = NO_CHUNK;
+      timelines.push_back(t);
+      return timelines.back();
+   }
+
+   void add_chunk(timeline* t, uint64_t offset, uint32_t count, uint32_t bytes)
+   {
+      if(count == 0) return;
+      chunk c;
+      c.first = t->calls;
+      c.offset = offset;
+      c.count = count;
+      c.bytes = bytes;
+      c.resident = false;
+      t->chunks.push_back(c);
+      t->calls += count;
+   }
+
+   void load(timeline* t, uint32_t n)
+   {
+      const chunk& c = t->chunks[n];
+      t->window.assign(c.count,0);
+      t->cached = n;
+      ndecoded++;
+      file.clear();
+      file.seekg(c.offset);
+      if(c.bytes == 0) {
+         file.read((char*)&t->window[0],sizeof(uint32_t)*c.count);
+         return;
+      }
+      packed.resize(c.bytes);
+      if(!file.read((char*)&packed[0],c.bytes) ||
+         !timeline_decode(&packed[0],c.bytes,&t->window[0],c.count)) {
+         t->window.assign(c.count,0);
+      }
+   }
+
+   std::ifstream file;
+   std::vector<timeline> timelines;
+   std::map<uint32_t,uint32_t> index; //target thread id -> index in timelines
+   std::vector<uint8_t> packed; //scratch for one chunk's tokens
+   uint64_t ndecoded;
+};
+
+//The calls of one timeline whose streams are shown, in call order, so
+//stepping, seeking and playing skip hidden streams without scanning them.
+//Positions are kept as 32-bit low words plus the index where each new
+//high word starts, 4 bytes per shown call. extend() indexes calls appended
+//since the last time; when what is shown changes, clear() and extend again.
+class VisibleCalls
+{
+public:
+   VisibleCalls() : indexed(0) {}
+
+   void clear()
+   {
+      low.clear();
+      high_start.clear();
+      indexed = 0;
+   }
+
+   //index calls [indexed(),calls(t)) of thread t; visible(stream) says if a stream is shown
+   template<class Visible>
+   void extend(TimelineReader& reader, uint32_t t, const Visible& visible)
+   {
+      uint64_t calls = reader.calls(t);
+      for(;indexed<calls;++indexed) {
+         if(!visible(reader.call(t,indexed))) continue;
+         while(indexed>>32 > high_start.size()) high_start.push_back(low.size());
+         low.push_back((uint32_t)indexed);
+      }
+   }
+
+   uint64_t size() const { return low.size(); }
+   uint64_t calls_indexed() const { return indexed; }
+
+   //position in the timeline of shown call k
+   uint64_t call(uint64_t k) const
+   {
+      uint64_t high = 0;
+      while(high < high_start.size() && high_start[high] <= k) high++;
+      return high<<32 | low[k];
+   }
+
+   //first shown call at or after position call, size() if none
+   uint64_t find(uint64_t position) const
+   {
+      uint64_t lo = 0, hi = low.size();
+      while(lo < hi) {
+         uint64_t mid = (lo+hi)/2;
+         if(call(mid) < position) lo = mid+1;
+         else hi = mid;
+      }
+      return lo;
+   }
+
+   //A cursor over the shown calls is at shown call k or, when the call it
+   //was at is not shown, between shown calls k-1 and k (k may be size()).
+   //The cursor for timeline position position; *between as above
+   uint64_t locate(uint64_t position, bool* between) const
+   {
+      uint64_t k = find(position);
+      *between = k == size() || call(k) != position;
+      return k;
+   }
+
+   //shown call steps on from cursor k, wrapping around; k < 0 starts
+   //before the first (steps > 0) or after the last (steps < 0)
+   int64_t step(int64_t k, bool between, int64_t steps) const
+   {
+      int64_t n = size();
+      if(n == 0) return -1;
+      if(k < 0) k = steps > 0 ? steps-1 : n+steps;
+      else if(between && steps > 0) k += steps-1;
+      else k += steps;
+      return (k%n+n)%n;
+   }
+
+private:
+   std::vector<uint32_t> low; //low word of each shown call's position
+   std::vector<uint64_t> high_start; //high_start[h-1]: first k whose position has high word >= h
+   uint64_t indexed; //calls looked at so far
+};
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef TRANSITIONS_H
+#define TRANSITIONS_H
+
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+
+#include "pvformat.h"
+
+//Which transitions between streams (the pv successor records) pinvis
+//draws. Dense graphs are thinned per stream: only transitions taken at
+//least a minimum number of times, and only the most taken few of those.
+//A stream following itself is left out; its loop is the stream itself.
+
+typedef struct {
+   uint32_t from; //stream ids
+   uint32_t to;
+   uint64_t count; //times taken
+} transition;
+
+inline bool more_taken(const transition& a, const transition& b)
+{
+   return a.count > b.count || (a.count == b.count && a.to < b.to);
+}
+
+//append to *out the transitions of stream from among edges[0..n) taken at
+//least min_count times, the most taken first and at most top of them (0
+//for no limit)
+inline void select_transitions(uint32_t from, const pv_edge* edges, uint64_t n, uint64_t min_count, uint32_t top,
+                               std::vector<transition>* out)
+{
+   size_t first = out->size();
+   for(uint64_t i=0;i<n;++i) {
+      if(edges[i].count < min_count || edges[i].id == from) continue;
+      transition t = { from, edges[i].id, edges[i].count };
+      out->push_back(t);
+   }
+   if(top && out->size()-first > top) {
+      std::partial_sort(out->begin()+first,out->begin()+first+top,out->end(),more_taken);
+      out->resize(first+top);
+   }
+   else {
+      std::sort(out->begin()+first,out->end(),more_taken);
+   }
+}
+
+#endif